@@ -2,6 +2,14 @@
 #include <linux/fs.h>
 #include <linux/device.h>
 #include <linux/cdev.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/seq_file.h>
+#include <linux/timekeeping.h>
+#include <linux/wait.h>
+
+#include "hook_stats.h"
 
 #define DEVICE_NAME "secrules"
 #define CLASS_NAME "sec_class"
@@ -10,19 +18,73 @@ static int major_number;
 static struct class* sec_class = NULL;
 static struct device* sec_device = NULL;
 static struct cdev sec_cdev;
+// Files waiting in poll() for a change of the rules
+static DECLARE_WAIT_QUEUE_HEAD(sec_change_wait);
 
-extern ssize_t rust_read(struct file *file, char *buffer, size_t len, loff_t *offset);
+extern ssize_t rust_read(void *file_data, char *buffer, size_t len, loff_t *offset);
 extern ssize_t rust_write(struct file *file, const char *buffer, size_t len, loff_t *offset);
-extern long rust_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+extern long rust_ioctl(void *file_data, unsigned int cmd, unsigned long arg);
+extern void *rust_open_file(void);
+extern void rust_release_file(void *file_data);
+extern bool rust_poll(void *file_data);
 
 int create_device(void);
 void remove_device(void);
+struct device *sec_device_get(void);
+void sec_notify_change(void);
+void sec_ioctl_stats_show(struct seq_file *m);
+
+// Cost of the ioctls, printed by sec_stats.c
+static DEFINE_PER_CPU(struct hook_stats, ioctl_stats);
+
+void sec_ioctl_stats_show(struct seq_file *m) {
+    hook_stats_print(m, "rust_ioctl", &ioctl_stats);
+}
+
+// Every open file gets its own state, owned by the Rust side (e.g. the rendered rules).
+static int sec_open(struct inode *inode, struct file *file) {
+    file->private_data = rust_open_file();
+    if (!file->private_data)
+        return -ENOMEM;
+    return 0;
+}
+
+static int sec_release(struct inode *inode, struct file *file) {
+    rust_release_file(file->private_data);
+    return 0;
+}
 
+static ssize_t sec_read(struct file *file, char __user *buffer, size_t len, loff_t *offset) {
+    return rust_read(file->private_data, buffer, len, offset);
+}
+
+// Called by the rule store after every change, under its lock: it must not sleep.
+void sec_notify_change(void) {
+    wake_up_interruptible(&sec_change_wait);
+}
+
+// Readable when a read would return something new, see rust_poll.
+static __poll_t sec_poll(struct file *file, poll_table *wait) {
+    poll_wait(file, &sec_change_wait, wait);
+    return rust_poll(file->private_data) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static long sec_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    u64 start_ns = ktime_get_ns();
+    long ret = rust_ioctl(file->private_data, cmd, arg);
+
+    hook_stats_record(&ioctl_stats, start_ns);
+    return ret;
+}
 
 static struct file_operations fops = {
     .owner = THIS_MODULE,
-    .read = rust_read,
-    .unlocked_ioctl = rust_ioctl,  // Register the ioctl handler
+    .open = sec_open,
+    .release = sec_release,
+    .read = sec_read,
+    .llseek = default_llseek,     // A long-lived fd seeks back to 0 to read the rules again
+    .poll = sec_poll,             // Wait for a change instead of reading the rules on a timer
+    .unlocked_ioctl = sec_ioctl,  // Register the ioctl handler
 };
 
 int create_device(void) {
@@ -60,6 +122,11 @@ int create_device(void) {
     return 0;
 }
 
+// The device of /dev/secrules, used to request the policy image (sec_firmware.c).
+struct device *sec_device_get(void) {
+    return sec_device;
+}
+
 void remove_device(void) {
     cdev_del(&sec_cdev);
     device_destroy(sec_class, MKDEV(major_number, 0));
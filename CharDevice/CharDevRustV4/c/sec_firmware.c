@@ -0,0 +1,39 @@
+// sec_firmware.c
+// Loads the policy image named by the "policy" parameter when the module is loaded,
+// e.g. insmod sec_module.ko policy=secrules.bin reads /lib/firmware/secrules.bin.
+// The firmware loader is not exposed by the Rust abstractions yet.
+
+#include <linux/firmware.h>
+#include <linux/module.h>
+
+extern int rust_load_policy(const u8 *image, size_t size);
+extern struct device *sec_device_get(void);
+
+int sec_firmware_load(void);
+
+static char *policy;
+module_param(policy, charp, 0444);
+MODULE_PARM_DESC(policy, "Policy image loaded at init from the firmware directory (see sec_tool compile)");
+
+// Returns 1 if the image has been loaded, 0 without a policy parameter, a negative errno on failure.
+int sec_firmware_load(void) {
+    const struct firmware *fw;
+    int ret;
+
+    if (!policy || !policy[0])
+        return 0;
+
+    ret = request_firmware(&fw, policy, sec_device_get());
+    if (ret < 0) {
+        printk(KERN_ERR "Failed to load the policy image %s: %d\n", policy, ret);
+        return ret;
+    }
+
+    ret = rust_load_policy(fw->data, fw->size);
+    release_firmware(fw);
+    if (ret < 0)
+        return ret;
+
+    printk(KERN_INFO "Loaded %d rules from the policy image %s\n", ret, policy);
+    return 1;
+}
@@ -0,0 +1,72 @@
+// sec_rcu.c
+// RCU and deferred work primitives used by the Rust rule store.
+// The Rust side publishes immutable versions of the rules: readers access them
+// inside an RCU read-side critical section, writers replace them and release the
+// old version only after a grace period.
+
+#include <linux/module.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+extern void rust_release_table(const void *table);
+extern void rust_publish_rules(void);
+
+void sec_rcu_read_lock(void);
+void sec_rcu_read_unlock(void);
+void sec_rcu_release_table(const void *table);
+void sec_schedule_publish(void);
+void sec_rcu_cleanup(void);
+
+struct sec_released_table {
+    struct rcu_head rcu;
+    const void *table;
+};
+
+static void sec_publish_work_fn(struct work_struct *work) {
+    rust_publish_rules();
+}
+
+static DECLARE_WORK(sec_publish_work, sec_publish_work_fn);
+
+void sec_rcu_read_lock(void) {
+    rcu_read_lock();
+}
+
+void sec_rcu_read_unlock(void) {
+    rcu_read_unlock();
+}
+
+static void sec_release_table_rcu(struct rcu_head *rcu) {
+    struct sec_released_table *released = container_of(rcu, struct sec_released_table, rcu);
+
+    rust_release_table(released->table);
+    kfree(released);
+}
+
+// Releases a table replaced by a writer once every reader is done with it.
+void sec_rcu_release_table(const void *table) {
+    struct sec_released_table *released = kmalloc(sizeof(*released), GFP_KERNEL);
+
+    if (!released) {
+        // No memory to queue the callback: wait for the readers here.
+        synchronize_rcu();
+        rust_release_table(table);
+        return;
+    }
+
+    released->table = table;
+    call_rcu(&released->rcu, sec_release_table_rcu);
+}
+
+// Publishes the pending changes of the writers off the ioctl path.
+// Several writes before the work runs are coalesced into a single publication.
+void sec_schedule_publish(void) {
+    schedule_work(&sec_publish_work);
+}
+
+// Waits for the pending publication and for the tables still waiting for a grace period.
+void sec_rcu_cleanup(void) {
+    cancel_work_sync(&sec_publish_work);
+    rcu_barrier();
+}
@@ -0,0 +1,59 @@
+// sec_rule_cache.c
+// Dedicated slab cache for the rules of the Rust store.
+// Every rule is a fixed size object with inline storage, so thousands of rules don't
+// fragment the generic kmalloc caches. The layout of the object is defined by the Rust
+// side, only its size is given to the cache.
+
+#include <linux/atomic.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+
+int sec_rule_cache_init(size_t object_size);
+void sec_rule_cache_destroy(void);
+void *sec_rule_alloc(void);
+void sec_rule_free(void *rule);
+long sec_rule_cache_objects(void);
+size_t sec_rule_cache_object_size(void);
+
+static struct kmem_cache *sec_rule_cache;
+static size_t sec_rule_object_size;
+// Objects currently allocated, shown by the statistics.
+static atomic_long_t sec_rule_objects = ATOMIC_LONG_INIT(0);
+
+int sec_rule_cache_init(size_t object_size) {
+    sec_rule_cache = kmem_cache_create("sec_rule", object_size, 0, 0, NULL);
+    if (!sec_rule_cache) {
+        printk(KERN_ALERT "Failed to create the rule cache\n");
+        return -ENOMEM;
+    }
+
+    sec_rule_object_size = object_size;
+    return 0;
+}
+
+// Releases all the slabs of the cache at once, the store must have been dropped.
+void sec_rule_cache_destroy(void) {
+    kmem_cache_destroy(sec_rule_cache);
+    sec_rule_cache = NULL;
+}
+
+void *sec_rule_alloc(void) {
+    void *rule = kmem_cache_alloc(sec_rule_cache, GFP_KERNEL);
+
+    if (rule)
+        atomic_long_inc(&sec_rule_objects);
+    return rule;
+}
+
+void sec_rule_free(void *rule) {
+    kmem_cache_free(sec_rule_cache, rule);
+    atomic_long_dec(&sec_rule_objects);
+}
+
+long sec_rule_cache_objects(void) {
+    return atomic_long_read(&sec_rule_objects);
+}
+
+size_t sec_rule_cache_object_size(void) {
+    return sec_rule_object_size;
+}
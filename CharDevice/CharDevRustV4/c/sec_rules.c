@@ -0,0 +1,76 @@
+// sec_rules.c
+// Exports the rule matcher of the Rust store to the other security modules.
+// The Rust side can't export symbols to other modules, this wrapper does it.
+
+#include <linux/module.h>
+#include <linux/string.h>
+
+#include "sec_rules.h"
+
+extern int rust_rules_check(u32 uid, const char *path, size_t len);
+extern bool rust_rules_has_user(u32 uid);
+extern u64 rust_rules_generation(void);
+
+void sec_policy_register(void);
+void sec_policy_unregister(void);
+
+// Modules enforcing the policy, they are optional: the ones loaded get it
+static const char *sec_policy_consumers[] = {
+    "my_lsm_set_policy",
+};
+
+#define SEC_POLICY_CONSUMERS ARRAY_SIZE(sec_policy_consumers)
+
+static sec_policy_set_fn sec_policy_registered[SEC_POLICY_CONSUMERS];
+
+int sec_rules_check(uid_t uid, const char *path) {
+    if (!path)
+        return 0;
+    return rust_rules_check(uid, path, strlen(path));
+}
+EXPORT_SYMBOL_GPL(sec_rules_check);
+
+static bool sec_rules_has_user(uid_t uid) {
+    return rust_rules_has_user(uid);
+}
+
+static u64 sec_rules_generation(void) {
+    return rust_rules_generation();
+}
+
+static const struct sec_policy_ops sec_policy = {
+    .check = sec_rules_check,
+    .has_rules = sec_rules_has_user,
+    .generation = sec_rules_generation,
+};
+
+// Hands the policy to every consumer already loaded.
+// The reference taken on each one keeps it loaded until sec_policy_unregister.
+void sec_policy_register(void) {
+    int i;
+
+    for (i = 0; i < SEC_POLICY_CONSUMERS; i++) {
+        sec_policy_set_fn set_policy = __symbol_get(sec_policy_consumers[i]);
+
+        if (!set_policy)
+            continue;
+        if (set_policy(&sec_policy) < 0) {
+            __symbol_put(sec_policy_consumers[i]);
+            continue;
+        }
+        sec_policy_registered[i] = set_policy;
+        printk(KERN_INFO "Policy registered with %s\n", sec_policy_consumers[i]);
+    }
+}
+
+void sec_policy_unregister(void) {
+    int i;
+
+    for (i = 0; i < SEC_POLICY_CONSUMERS; i++) {
+        if (!sec_policy_registered[i])
+            continue;
+        sec_policy_registered[i](NULL);
+        sec_policy_registered[i] = NULL;
+        __symbol_put(sec_policy_consumers[i]);
+    }
+}
@@ -0,0 +1,34 @@
+// sec_rules.h
+// Interface exported by sec_module to the other security modules (Kprobes, LSM).
+
+#ifndef SEC_RULES_H
+#define SEC_RULES_H
+
+#include <linux/types.h>
+
+// Checks the path opened by the given user against its path rules.
+// A path rule starts with '/': if it ends with '/' or '*' it matches every path with
+// that prefix, otherwise only the same path. The other rules are not evaluated.
+// Returns -EACCES if a rule matches, 0 otherwise.
+// It never sleeps, so it can be called from the kprobe and LSM hooks.
+int sec_rules_check(uid_t uid, const char *path);
+
+// Policy exported by the rule store to the enforcement modules.
+// The functions never sleep; the rules they read are a compiled image published
+// by the store off the hot path, after every change made through the ioctls.
+struct sec_policy_ops {
+    // Same as sec_rules_check
+    int (*check)(uid_t uid, const char *path);
+    // True if the user has path rules, lets the hooks skip building the path
+    bool (*has_rules)(uid_t uid);
+    // Version of the published rules, it changes after every change of the rules:
+    // a decision cached with an older generation must not be used
+    u64 (*generation)(void);
+};
+
+// Implemented and exported by each consumer of the policy (e.g. my_lsm_set_policy).
+// The rule store calls it with its policy when it is loaded, and with NULL before
+// being unloaded: the consumer must not use the old policy once it returns.
+typedef int (*sec_policy_set_fn)(const struct sec_policy_ops *ops);
+
+#endif
@@ -0,0 +1,38 @@
+// sec_stats.c
+// Statistics of the rule store, exposed in debugfs as secrules/stats.
+
+#include <linux/debugfs.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+
+extern long sec_rule_cache_objects(void);
+extern size_t sec_rule_cache_object_size(void);
+extern void sec_ioctl_stats_show(struct seq_file *m);
+
+void sec_stats_init(void);
+void sec_stats_cleanup(void);
+
+static struct dentry *sec_stats_dir;
+
+static int sec_stats_show(struct seq_file *m, void *v) {
+    long objects = sec_rule_cache_objects();
+    size_t object_size = sec_rule_cache_object_size();
+
+    seq_printf(m, "rule_objects: %ld\n", objects);
+    seq_printf(m, "rule_object_size: %zu\n", object_size);
+    seq_printf(m, "rule_bytes: %ld\n", objects * (long)object_size);
+    sec_ioctl_stats_show(m);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sec_stats);
+
+// The statistics are optional: if debugfs is not available the module works anyway.
+void sec_stats_init(void) {
+    sec_stats_dir = debugfs_create_dir("secrules", NULL);
+    debugfs_create_file("stats", 0444, sec_stats_dir, NULL, &sec_stats_fops);
+}
+
+void sec_stats_cleanup(void) {
+    debugfs_remove_recursive(sec_stats_dir);
+    sec_stats_dir = NULL;
+}
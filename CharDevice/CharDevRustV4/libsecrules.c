@@ -0,0 +1,599 @@
+// libsecrules.c
+// Implementation of the user space API of the security rules device, see libsecrules.h.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libsecrules.h"
+
+struct secrules {
+    int fd;
+    unsigned long batch_cmd;              // IOCTL_ADD_RULES or IOCTL_REMOVE_RULES, 0 if empty
+    u32 count;                            // Entries queued
+    IoctlArgument entries[BATCH_SIZE];
+    int32_t status[BATCH_SIZE];
+    int tags[BATCH_SIZE];
+    secrules_reject_fn rejected;
+    void *ctx;
+};
+
+// Function to sanitize input and create IoctlArgument
+int create_ioctl_argument(u32 uid, const char *rule, IoctlArgument *arg) {
+    
+    // Validate that arg is not NULL
+    if (!arg) {
+        fprintf(stderr, "Error: IoctlArgument is NULL.\n");
+        return -1;
+    }
+
+    // Validate that rule is not NULL
+    if (!rule) {
+        fprintf(stderr, "Error: Rule string is NULL.\n");
+        return -1;
+    }
+
+    // Validate that the rule is a valid UTF-8 string and does not exceed RULE_SIZE
+    size_t rule_len = strnlen(rule, RULE_SIZE - 1);  // -1 to leave space for the null terminator
+
+    // Check if the rule is within the allowed length and does not contain interior NULs
+    if (rule_len == RULE_SIZE - 1 && rule[rule_len] != '\0') {
+        fprintf(stderr, "Error: Rule string is too long or contains interior NUL bytes.\n");
+        return -1;
+    }
+
+    // Initialize the IoctlArgument structure
+    memset(arg, 0, sizeof(IoctlArgument));
+    arg->uid = uid;
+
+    // Copy the rule to the IoctlArgument structure, copying only up to the actual length of the rule
+    memcpy(arg->rule, rule, rule_len);
+
+    // Ensure the last character is a NUL terminator
+    arg->rule[rule_len] = '\0';
+
+    return 0; // Success
+}
+
+// Function to sanitize input and create IoctlRuleArgumentV2, the rule is not copied
+int create_ioctl_rule_argument(u32 uid, const char *rule, IoctlRuleArgumentV2 *arg) {
+
+    // Validate that arg and rule are not NULL
+    if (!arg || !rule) {
+        fprintf(stderr, "Error: IoctlRuleArgumentV2 or rule string is NULL.\n");
+        return -1;
+    }
+
+    // The kernel accepts at most RULE_SIZE bytes, stop counting right after
+    size_t rule_len = strnlen(rule, RULE_SIZE + 1);
+    if (rule_len > RULE_SIZE) {
+        fprintf(stderr, "Error: Rule string is too long.\n");
+        return -1;
+    }
+
+    memset(arg, 0, sizeof(IoctlRuleArgumentV2));
+    arg->uid = uid;
+    arg->rule_len = (u32)rule_len;
+    arg->rule = (uint64_t)(uintptr_t)rule;
+
+    return 0; // Success
+}
+
+// Function to sanitize input and create IoctlReadArgument
+int create_ioctl_read_argument(u32 uid, IoctlReadArgument *arg) {
+
+    // Validate that arg is not NULL
+    if (!arg) {
+        fprintf(stderr, "Error: IoctlReadArgument is NULL.\n");
+        return -1;
+    }
+    
+    // Initialize the IoctlArgument structure
+    memset(arg, 0, sizeof(IoctlReadArgument));
+    arg->uid = uid;
+
+    // Allocate memory for the rules_buffer
+    // Ensure this matches the size expected in the kernel (RULE_BUFFER_SIZE)
+    memset(arg->buffer, 0, BUFFER_SIZE);
+
+    return 0; // Success
+}
+
+secrules_t *secrules_open(void) {
+    secrules_t *handle = calloc(1, sizeof(secrules_t));
+    if (!handle)
+        return NULL;
+
+    handle->fd = open(DEVICE_PATH, O_RDWR);
+    if (handle->fd < 0) {
+        int error = errno;
+        free(handle);
+        errno = error;
+        return NULL;
+    }
+
+    return handle;
+}
+
+void secrules_close(secrules_t *handle) {
+    if (!handle)
+        return;
+
+    secrules_flush(handle);
+    close(handle->fd);
+    free(handle);
+}
+
+void secrules_set_reject_handler(secrules_t *handle, secrules_reject_fn rejected, void *ctx) {
+    handle->rejected = rejected;
+    handle->ctx = ctx;
+}
+
+static int send_rule(secrules_t *handle, unsigned long cmd, u32 uid, const char *rule) {
+    IoctlRuleArgumentV2 arg;
+
+    if (create_ioctl_rule_argument(uid, rule, &arg) < 0)
+        return -EINVAL;
+    if (ioctl(handle->fd, cmd, &arg) < 0)
+        return -errno;
+    return 0;
+}
+
+int secrules_add(secrules_t *handle, u32 uid, const char *rule) {
+    return send_rule(handle, IOCTL_ADD_RULE_V2, uid, rule);
+}
+
+int secrules_remove(secrules_t *handle, u32 uid, const char *rule) {
+    return send_rule(handle, IOCTL_REMOVE_RULE_V2, uid, rule);
+}
+
+int secrules_read(secrules_t *handle, u32 uid, char **buffer, size_t *len) {
+    // Start with the old fixed size, grow the buffer if the kernel asks for more
+    u32 buffer_len = BUFFER_SIZE;
+    char *rules = NULL;
+
+    for (;;) {
+        char *larger = realloc(rules, (size_t)buffer_len + 1);
+        if (!larger) {
+            free(rules);
+            return -ENOMEM;
+        }
+        rules = larger;
+
+        IoctlReadArgumentV2 arg;
+        memset(&arg, 0, sizeof(IoctlReadArgumentV2));
+        arg.uid = uid;
+        arg.buffer_len = buffer_len;
+        arg.buffer = (uint64_t)(uintptr_t)rules;
+
+        if (ioctl(handle->fd, IOCTL_READ_RULES_V2, &arg) == 0) {
+            rules[arg.buffer_len] = '\0';
+            *buffer = rules;
+            if (len)
+                *len = arg.buffer_len;
+            return 0;
+        }
+
+        if (errno != ENOSPC) {
+            int error = errno;
+            free(rules);
+            return -error;
+        }
+
+        // The rules changed size in the meantime, or the buffer was too small
+        buffer_len = arg.buffer_len;
+    }
+}
+
+int secrules_set_read_format(secrules_t *handle, u32 format) {
+    if (ioctl(handle->fd, IOCTL_SET_READ_FORMAT, &format) < 0)
+        return -errno;
+    return 0;
+}
+
+int secrules_dump(secrules_t *handle, int out_fd) {
+    int ret = 0;
+
+    // Reading from the start renders the current rules, the following chunks come from the same snapshot
+    if (lseek(handle->fd, 0, SEEK_SET) < 0)
+        return -errno;
+
+    char *buffer = malloc(SECRULES_DUMP_CHUNK);
+    if (!buffer)
+        return -ENOMEM;
+
+    for (;;) {
+        ssize_t bytes_read = read(handle->fd, buffer, SECRULES_DUMP_CHUNK);
+        if (bytes_read == 0)
+            break;
+        if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
+            ret = -errno;
+            break;
+        }
+
+        for (ssize_t written = 0; written < bytes_read; ) {
+            ssize_t n = write(out_fd, buffer + written, bytes_read - written);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                ret = -errno;
+                goto out;
+            }
+            written += n;
+        }
+    }
+
+out:
+    free(buffer);
+    return ret;
+}
+
+int secrules_wait(secrules_t *handle, int timeout_ms) {
+    struct pollfd fds = { .fd = handle->fd, .events = POLLIN };
+
+    for (;;) {
+        int ret = poll(&fds, 1, timeout_ms);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        return ret > 0 ? 1 : 0;
+    }
+}
+
+int secrules_flush(secrules_t *handle) {
+    IoctlBatchArgument batch;
+    int failures = 0;
+
+    if (handle->count == 0)
+        return 0;
+
+    memset(&batch, 0, sizeof(IoctlBatchArgument));
+    memset(handle->status, 0, handle->count * sizeof(int32_t));
+    batch.count = handle->count;
+    batch.entries = (uint64_t)(uintptr_t)handle->entries;
+    batch.status = (uint64_t)(uintptr_t)handle->status;
+
+    int ret = ioctl(handle->fd, handle->batch_cmd, &batch);
+    int error = errno;
+
+    for (u32 i = 0; i < handle->count; i++) {
+        // If the whole ioctl failed every entry is rejected, and the batch is dropped anyway
+        int entry_error = ret < 0 ? error : -handle->status[i];
+        if (entry_error != 0) {
+            if (handle->rejected)
+                handle->rejected(handle->ctx, handle->tags[i], entry_error);
+            failures++;
+        }
+    }
+
+    handle->count = 0;
+    handle->batch_cmd = 0;
+    return ret < 0 ? -error : failures;
+}
+
+static int queue_rule(secrules_t *handle, unsigned long cmd, u32 uid, const char *rule, int tag) {
+    // A batch contains only one kind of request, the order of the requests is kept
+    if (handle->count == BATCH_SIZE || (handle->count > 0 && handle->batch_cmd != cmd)) {
+        int ret = secrules_flush(handle);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (create_ioctl_argument(uid, rule, &handle->entries[handle->count]) < 0)
+        return -EINVAL;
+
+    handle->batch_cmd = cmd;
+    handle->tags[handle->count] = tag;
+    handle->count++;
+    return 0;
+}
+
+int secrules_batch_add(secrules_t *handle, u32 uid, const char *rule, int tag) {
+    return queue_rule(handle, IOCTL_ADD_RULES, uid, rule, tag);
+}
+
+int secrules_batch_remove(secrules_t *handle, u32 uid, const char *rule, int tag) {
+    return queue_rule(handle, IOCTL_REMOVE_RULES, uid, rule, tag);
+}
+
+int secrules_load(secrules_t *handle, const void *image, size_t size) {
+    IoctlPolicyArgument arg;
+
+    // The batches queued before the image would be applied to the old rules
+    int ret = secrules_flush(handle);
+    if (ret < 0)
+        return ret;
+    if (size > UINT32_MAX)
+        return -E2BIG;
+
+    memset(&arg, 0, sizeof(IoctlPolicyArgument));
+    arg.size = (u32)size;
+    arg.image = (uint64_t)(uintptr_t)image;
+
+    if (ioctl(handle->fd, IOCTL_LOAD_POLICY, &arg) < 0)
+        return -errno;
+    return (int)arg.rules;
+}
+
+// Image builder: the distinct rules and the users are kept in insertion order,
+// each one located through an open addressing table of indexes (0 is a free slot).
+struct image_string {
+    char *bytes;
+    u32 len;
+    u32 hash;
+};
+
+struct image_user {
+    u32 uid;
+    u32 count;
+    u32 capacity;
+    u32 *rules;            // Indexes in the strings
+};
+
+struct secrules_image {
+    struct image_string *strings;
+    u32 nstrings;
+    u32 strings_capacity;
+    u32 *string_slots;     // Index + 1 of the string, 0 if free
+    u32 string_slots_len;  // Power of two
+    struct image_user *users;
+    u32 nusers;
+    u32 users_capacity;
+    u32 *user_slots;       // Index + 1 of the user, 0 if free
+    u32 user_slots_len;    // Power of two
+    u32 rules;
+};
+
+// Same hash used by the kernel for the rules (FNV-1a)
+static u32 hash_bytes(const char *bytes, size_t len) {
+    u32 hash = 0x811c9dc5;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+// Home slot of a user in a table of len slots, a power of two. Same hash as the kernel
+// (common/uid_hash.rs): the top bits of the product, the low ones only depend on uid % len.
+static u32 hash_uid(u32 uid, u32 len) {
+    return (u32)(uid * 0x61c88647u) >> (32 - __builtin_ctz(len));
+}
+
+// Same check as core::str::from_utf8 in the kernel: no overlong forms, surrogates or code points past U+10FFFF
+static int valid_utf8(const unsigned char *s, size_t len) {
+    size_t i = 0;
+
+    while (i < len) {
+        unsigned char c = s[i];
+        size_t extra;
+        uint32_t cp;
+
+        if (c < 0x80) {
+            i++;
+            continue;
+        } else if (c >= 0xc2 && c <= 0xdf) {
+            extra = 1;
+            cp = c & 0x1f;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            extra = 2;
+            cp = c & 0x0f;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            extra = 3;
+            cp = c & 0x07;
+        } else {
+            return 0;
+        }
+
+        if (len - i <= extra)
+            return 0;
+        for (size_t j = 1; j <= extra; j++) {
+            if ((s[i + j] & 0xc0) != 0x80)
+                return 0;
+            cp = (cp << 6) | (s[i + j] & 0x3f);
+        }
+
+        if ((extra == 2 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) ||
+            (extra == 3 && (cp < 0x10000 || cp > 0x10ffff)))
+            return 0;
+        i += extra + 1;
+    }
+
+    return 1;
+}
+
+// Doubles the capacity of an array of elements of the given size
+static int grow_array(void **array, u32 *capacity, size_t size) {
+    u32 new_capacity = *capacity ? *capacity * 2 : 64;
+    void *larger = realloc(*array, (size_t)new_capacity * size);
+    if (!larger)
+        return -ENOMEM;
+
+    *array = larger;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// Rebuilds a table of indexes with twice the slots, home_of gives the home slot of an index
+static int grow_slots(secrules_image_t *image, u32 **slots, u32 *slots_len, u32 count,
+                      u32 (*home_of)(secrules_image_t *, u32, u32)) {
+    u32 new_len = *slots_len ? *slots_len * 2 : 128;
+    u32 *new_slots = calloc(new_len, sizeof(u32));
+    if (!new_slots)
+        return -ENOMEM;
+
+    for (u32 index = 0; index < count; index++) {
+        u32 slot = home_of(image, index, new_len);
+        while (new_slots[slot])
+            slot = (slot + 1) & (new_len - 1);
+        new_slots[slot] = index + 1;
+    }
+
+    free(*slots);
+    *slots = new_slots;
+    *slots_len = new_len;
+    return 0;
+}
+
+static u32 string_home_of(secrules_image_t *image, u32 index, u32 len) {
+    return image->strings[index].hash & (len - 1);
+}
+
+static u32 user_home_of(secrules_image_t *image, u32 index, u32 len) {
+    return hash_uid(image->users[index].uid, len);
+}
+
+// Returns the index of the rule, adding it if new, or a negative errno
+static long image_intern(secrules_image_t *image, const char *rule, size_t len) {
+    u32 hash = hash_bytes(rule, len);
+
+    if ((image->nstrings + 1) * 4 > image->string_slots_len * 3 &&
+        grow_slots(image, &image->string_slots, &image->string_slots_len, image->nstrings, string_home_of) < 0)
+        return -ENOMEM;
+
+    u32 mask = image->string_slots_len - 1;
+    u32 slot = hash & mask;
+    for (; image->string_slots[slot]; slot = (slot + 1) & mask) {
+        struct image_string *string = &image->strings[image->string_slots[slot] - 1];
+        if (string->hash == hash && string->len == len && memcmp(string->bytes, rule, len) == 0)
+            return image->string_slots[slot] - 1;
+    }
+
+    if (image->nstrings == image->strings_capacity &&
+        grow_array((void **)&image->strings, &image->strings_capacity, sizeof(struct image_string)) < 0)
+        return -ENOMEM;
+
+    struct image_string *string = &image->strings[image->nstrings];
+    string->bytes = malloc(len ? len : 1);
+    if (!string->bytes)
+        return -ENOMEM;
+    memcpy(string->bytes, rule, len);
+    string->len = (u32)len;
+    string->hash = hash;
+
+    image->string_slots[slot] = ++image->nstrings;
+    return image->nstrings - 1;
+}
+
+// Returns the user, adding it if new, or NULL
+static struct image_user *image_user(secrules_image_t *image, u32 uid) {
+    if ((image->nusers + 1) * 4 > image->user_slots_len * 3 &&
+        grow_slots(image, &image->user_slots, &image->user_slots_len, image->nusers, user_home_of) < 0)
+        return NULL;
+
+    u32 mask = image->user_slots_len - 1;
+    u32 slot = hash_uid(uid, image->user_slots_len);
+    for (; image->user_slots[slot]; slot = (slot + 1) & mask) {
+        struct image_user *user = &image->users[image->user_slots[slot] - 1];
+        if (user->uid == uid)
+            return user;
+    }
+
+    if (image->nusers == image->users_capacity &&
+        grow_array((void **)&image->users, &image->users_capacity, sizeof(struct image_user)) < 0)
+        return NULL;
+
+    struct image_user *user = &image->users[image->nusers];
+    memset(user, 0, sizeof(struct image_user));
+    user->uid = uid;
+
+    image->user_slots[slot] = ++image->nusers;
+    return user;
+}
+
+secrules_image_t *secrules_image_new(void) {
+    return calloc(1, sizeof(secrules_image_t));
+}
+
+void secrules_image_free(secrules_image_t *image) {
+    if (!image)
+        return;
+
+    for (u32 i = 0; i < image->nstrings; i++)
+        free(image->strings[i].bytes);
+    for (u32 i = 0; i < image->nusers; i++)
+        free(image->users[i].rules);
+    free(image->strings);
+    free(image->string_slots);
+    free(image->users);
+    free(image->user_slots);
+    free(image);
+}
+
+int secrules_image_add(secrules_image_t *image, u32 uid, const char *rule) {
+    size_t len = strnlen(rule, RULE_SIZE + 1);
+    if (len > RULE_SIZE || !valid_utf8((const unsigned char *)rule, len))
+        return -EINVAL;
+    if (image->rules == UINT32_MAX)
+        return -E2BIG;
+
+    long index = image_intern(image, rule, len);
+    if (index < 0)
+        return (int)index;
+
+    struct image_user *user = image_user(image, uid);
+    if (!user)
+        return -ENOMEM;
+    if (user->count == user->capacity &&
+        grow_array((void **)&user->rules, &user->capacity, sizeof(u32)) < 0)
+        return -ENOMEM;
+
+    user->rules[user->count++] = (u32)index;
+    image->rules++;
+    return 0;
+}
+
+static unsigned char *put_u32(unsigned char *out, u32 value) {
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = (value >> 24) & 0xff;
+    return out + 4;
+}
+
+int secrules_image_encode(secrules_image_t *image, void **buffer, size_t *size) {
+    size_t total = SECRULES_IMAGE_HEADER_SIZE;
+
+    for (u32 i = 0; i < image->nstrings; i++)
+        total += 4 + image->strings[i].len;
+    total += (size_t)image->nusers * 8 + (size_t)image->rules * 4;
+    if (total > UINT32_MAX)
+        return -E2BIG;
+
+    unsigned char *out = malloc(total);
+    if (!out)
+        return -ENOMEM;
+    *buffer = out;
+    *size = total;
+
+    memcpy(out, SECRULES_IMAGE_MAGIC, 4);
+    out = put_u32(out + 4, SECRULES_IMAGE_VERSION);
+    out = put_u32(out, (u32)total);
+    out = put_u32(out, image->nstrings);
+    out = put_u32(out, image->nusers);
+    out = put_u32(out, image->rules);
+
+    for (u32 i = 0; i < image->nstrings; i++) {
+        out = put_u32(out, image->strings[i].len);
+        memcpy(out, image->strings[i].bytes, image->strings[i].len);
+        out += image->strings[i].len;
+    }
+
+    for (u32 i = 0; i < image->nusers; i++) {
+        struct image_user *user = &image->users[i];
+        out = put_u32(out, user->uid);
+        out = put_u32(out, user->count);
+        for (u32 j = 0; j < user->count; j++)
+            out = put_u32(out, user->rules[j]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+// libsecrules.h
+// User space API of the security rules device (/dev/secrules).
+// A handle keeps one open file descriptor for all the requests, and can queue
+// rules to send them in batches with a single ioctl.
+
+#ifndef LIBSECRULES_H
+#define LIBSECRULES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+// Define the IOCTL commands
+#define IOCTL_MAGIC 's'
+#define IOCTL_ADD_RULE _IOW(IOCTL_MAGIC, 1, IoctlArgument)
+#define IOCTL_REMOVE_RULE _IOW(IOCTL_MAGIC, 2, IoctlArgument)
+#define IOCTL_READ_RULES _IOR(IOCTL_MAGIC, 3, IoctlReadArgument)
+#define IOCTL_ADD_RULES _IOWR(IOCTL_MAGIC, 4, IoctlBatchArgument)
+#define IOCTL_REMOVE_RULES _IOWR(IOCTL_MAGIC, 5, IoctlBatchArgument)
+#define IOCTL_ADD_RULE_V2 _IOW(IOCTL_MAGIC, 6, IoctlRuleArgumentV2)
+#define IOCTL_REMOVE_RULE_V2 _IOW(IOCTL_MAGIC, 7, IoctlRuleArgumentV2)
+#define IOCTL_READ_RULES_V2 _IOWR(IOCTL_MAGIC, 8, IoctlReadArgumentV2)
+#define IOCTL_SET_READ_FORMAT _IOW(IOCTL_MAGIC, 9, uint32_t)
+#define IOCTL_LOAD_POLICY _IOWR(IOCTL_MAGIC, 10, IoctlPolicyArgument)
+
+#define DEVICE_PATH "/dev/secrules"
+#define RULE_SIZE 256
+#define BUFFER_SIZE RULE_SIZE*16
+#define BATCH_SIZE 1024 // Max number of rules in a single batched ioctl (IOCTL_BATCH_MAX)
+#define SECRULES_ALL_USERS UINT32_MAX
+#define SECRULES_DUMP_CHUNK (1 << 16) // Size of each read of secrules_dump
+
+// Formats of the rules returned by read() on the device
+#define SECRULES_FORMAT_TEXT 0 // "---- UID: <uid> ----" blocks
+#define SECRULES_FORMAT_TSV 1  // One "<uid>\t<rule>" line per rule, backslash, tab and newline escaped as \\, \t and \n
+#define SECRULES_FORMAT_BINARY 2 // Policy image of the whole store, see below
+// Changes since the last read of the handle, one "+<uid>\t<rule>" (added) or "-<uid>\t<rule>" (removed)
+// line each, escaped as SECRULES_FORMAT_TSV. A "*" line means: forget every rule, the whole store
+// follows as added rules. The first read of the handle starts with it.
+#define SECRULES_FORMAT_DELTA 3
+
+// Policy image: a whole policy loaded with a single request, the store is built straight from it.
+// Every integer is a little endian u32:
+//   header:  magic "SECP", version, size of the whole image, strings, users, rules
+//   strings: `strings` times: length, bytes of the rule (no NUL byte)
+//   users:   `users` times: uid, number of rules, index of each rule in the strings
+#define SECRULES_IMAGE_MAGIC "SECP"
+#define SECRULES_IMAGE_VERSION 1
+#define SECRULES_IMAGE_HEADER_SIZE 24
+
+typedef uint32_t u32 ;
+
+// Updated struct to match the kernel module
+struct IoctlArgument {
+    u32 uid;             // User ID
+    char rule[RULE_SIZE]; // Rule string
+} typedef IoctlArgument;
+
+struct IoctlReadArgument {
+    u32 uid;         // User ID (MAX U32 indicates no specific user ID)
+    char buffer[BUFFER_SIZE]; // Buffer to store rules
+} typedef IoctlReadArgument;
+
+// Batch of rules applied with a single ioctl, entries and status point to arrays of count elements
+struct IoctlBatchArgument {
+    u32 count;            // Number of entries
+    u32 applied;          // Set by the kernel: number of entries applied
+    uint64_t entries;     // IoctlArgument array
+    uint64_t status;      // int32_t array, set by the kernel: 0 or -errno for each entry
+} typedef IoctlBatchArgument;
+
+// Version 2 of the single rule commands, payloads are passed by pointer and length
+struct IoctlRuleArgumentV2 {
+    u32 uid;              // User ID
+    u32 rule_len;         // Length of the rule without NUL terminator
+    uint64_t rule;        // Rule string
+} typedef IoctlRuleArgumentV2;
+
+struct IoctlReadArgumentV2 {
+    u32 uid;              // User ID (MAX U32 indicates all the users)
+    u32 buffer_len;       // Size of the buffer, set by the kernel to the size of the rules
+    uint64_t buffer;      // Buffer to store rules
+} typedef IoctlReadArgumentV2;
+
+// Replaces all the rules with the ones of a policy image
+struct IoctlPolicyArgument {
+    u32 size;             // Size of the image
+    u32 rules;            // Set by the kernel: number of rules loaded
+    uint64_t image;       // Policy image
+} typedef IoctlPolicyArgument;
+
+int create_ioctl_argument(u32 uid, const char *rule, IoctlArgument *arg);
+int create_ioctl_rule_argument(u32 uid, const char *rule, IoctlRuleArgumentV2 *arg);
+int create_ioctl_read_argument(u32 uid, IoctlReadArgument *arg);
+
+// Handle of the device, it is not thread safe
+typedef struct secrules secrules_t;
+
+// Called by a flush for every rejected entry of the batch, with the tag given when the
+// entry was queued (e.g. a line number) and the errno of the failure
+typedef void (*secrules_reject_fn)(void *ctx, int tag, int error);
+
+// All the functions returning int return 0 on success or a negative errno
+
+// Opens the device, returns NULL and sets errno on failure
+secrules_t *secrules_open(void);
+// Sends the pending batch, then closes the device
+void secrules_close(secrules_t *handle);
+void secrules_set_reject_handler(secrules_t *handle, secrules_reject_fn rejected, void *ctx);
+
+// Single requests, applied immediately
+int secrules_add(secrules_t *handle, u32 uid, const char *rule);
+int secrules_remove(secrules_t *handle, u32 uid, const char *rule);
+// Reads the rules of the user (SECRULES_ALL_USERS for every user) in the format of /dev/secrules.
+// *buffer is allocated with malloc and NUL-terminated, the caller frees it.
+int secrules_read(secrules_t *handle, u32 uid, char **buffer, size_t *len);
+
+// Selects the format used by secrules_dump
+int secrules_set_read_format(secrules_t *handle, u32 format);
+// Writes all the rules to out_fd, reading them from the device in large chunks.
+// With SECRULES_FORMAT_DELTA it writes the changes not read yet.
+int secrules_dump(secrules_t *handle, int out_fd);
+// Waits until a read would return something new: a change for SECRULES_FORMAT_DELTA, a
+// different set of rules otherwise. Returns 1 if so, 0 after timeout_ms (-1 waits forever).
+int secrules_wait(secrules_t *handle, int timeout_ms);
+
+// Batched requests: the rules are queued and sent with a single ioctl when the batch
+// is full, when a request of the other kind is queued, or by secrules_flush
+int secrules_batch_add(secrules_t *handle, u32 uid, const char *rule, int tag);
+int secrules_batch_remove(secrules_t *handle, u32 uid, const char *rule, int tag);
+// Sends the pending batch, returns the number of rejected entries. If the ioctl itself
+// fails it returns a negative errno, after reporting every entry of the batch as rejected.
+int secrules_flush(secrules_t *handle);
+
+// Replaces all the rules with the ones of a policy image, returns the number of rules
+// loaded or a negative errno. On error the current rules are kept.
+int secrules_load(secrules_t *handle, const void *image, size_t size);
+
+// Builder of a policy image, with the same checks applied by the kernel to every rule:
+// a policy rejected by the kernel is rejected here, before it is loaded
+typedef struct secrules_image secrules_image_t;
+
+// Returns NULL on allocation failure
+secrules_image_t *secrules_image_new(void);
+void secrules_image_free(secrules_image_t *image);
+// Adds a rule to the user, as IOCTL_ADD_RULE would: users and rules keep their order
+int secrules_image_add(secrules_image_t *image, u32 uid, const char *rule);
+// Encodes the image. *buffer is allocated with malloc, the caller frees it.
+int secrules_image_encode(secrules_image_t *image, void **buffer, size_t *size);
+
+#endif
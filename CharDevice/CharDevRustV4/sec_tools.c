@@ -3,191 +3,485 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
-#include <sys/ioctl.h>
 #include <stdint.h>
+#include <errno.h>
 
-// Define the IOCTL commands
-#define IOCTL_MAGIC 's'
-#define IOCTL_ADD_RULE _IOW(IOCTL_MAGIC, 1, IoctlArgument)
-#define IOCTL_REMOVE_RULE _IOW(IOCTL_MAGIC, 2, IoctlArgument)
-#define IOCTL_READ_RULES _IOR(IOCTL_MAGIC, 3, IoctlReadArgument)
+#include "libsecrules.h"
 
-#define DEVICE_PATH "/dev/secrules"
-#define RULE_SIZE 256
-#define BUFFER_SIZE RULE_SIZE*16
+#define LINE_SIZE (RULE_SIZE + 32)
 
-typedef uint32_t u32 ;
-
-// Updated struct to match the kernel module
-struct IoctlArgument {
-    u32 uid;             // User ID
-    char rule[RULE_SIZE]; // Rule string
-} typedef IoctlArgument;
-
-struct IoctlReadArgument {
-    u32 uid;         // User ID (MAX U32 indicates no specific user ID)
-    char buffer[BUFFER_SIZE]; // Buffer to store rules
-} typedef IoctlReadArgument;
-
-int create_ioctl_argument(u32 uid, const char *rule, IoctlArgument *arg);
-int create_ioctl_read_argument(u32 uid, IoctlReadArgument *arg);
 void add_rule(u32 uid, const char *rule);
 void remove_rule(u32 uid, const char *rule);
 void print_man();
-void print_rules();
+void print_rules(u32 format);
 void print_rules_by_id(u32 uid);
+void import_rules(const char *path);
+void run_shell(void);
+void compile_rules(const char *path, const char *output_path);
+void load_policy(const char *path);
+void save_policy(const char *output_path);
+void watch_rules(void);
 int get_command(const char* command);
 
-// Function to sanitize input and create IoctlArgument
-int create_ioctl_argument(u32 uid, const char *rule, IoctlArgument *arg) {
-    
-    // Validate that arg is not NULL
-    if (!arg) {
-        fprintf(stderr, "Error: IoctlArgument is NULL.\n");
-        return -1;
+// Function to map command strings to integer values
+int get_command(const char *command) {
+    if (strcmp(command, "print") == 0) return 1;
+    if (strcmp(command, "add") == 0) return 2;
+    if (strcmp(command, "rmv") == 0) return 3;
+    if (strcmp(command, "man") == 0) return 4;
+    if (strcmp(command, "import") == 0) return 5;
+    if (strcmp(command, "shell") == 0) return 6;
+    if (strcmp(command, "export") == 0) return 7;
+    if (strcmp(command, "compile") == 0) return 8;
+    if (strcmp(command, "load") == 0) return 9;
+    if (strcmp(command, "save") == 0) return 10;
+    if (strcmp(command, "watch") == 0) return 11;
+    return 0; // Unknown command
+}
+
+// Function to add new rule
+void add_rule(u32 uid, const char *rule) {
+    secrules_t *handle = secrules_open();
+    if (!handle) {
+        perror("Failed to open the device");
+        return;
     }
 
-    // Validate that rule is not NULL
-    if (!rule) {
-        fprintf(stderr, "Error: Rule string is NULL.\n");
-        return -1;
+    int ret = secrules_add(handle, uid, rule);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to add rule via ioctl: %s\n", strerror(-ret));
     }
 
-    // Validate that the rule is a valid UTF-8 string and does not exceed RULE_SIZE
-    size_t rule_len = strnlen(rule, RULE_SIZE - 1);  // -1 to leave space for the null terminator
+    secrules_close(handle);
+}
 
-    // Check if the rule is within the allowed length and does not contain interior NULs
-    if (rule_len == RULE_SIZE - 1 && rule[rule_len] != '\0') {
-        fprintf(stderr, "Error: Rule string is too long or contains interior NUL bytes.\n");
-        return -1;
+// Function to remove a rule from a specific user
+void remove_rule(u32 uid, const char *rule) {
+    secrules_t *handle = secrules_open();
+    if (!handle) {
+        perror("Failed to open the device");
+        return;
     }
 
-    // Initialize the IoctlArgument structure
-    memset(arg, 0, sizeof(IoctlArgument));
-    arg->uid = uid;
+    int ret = secrules_remove(handle, uid, rule);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to remove rule via ioctl: %s\n", strerror(-ret));
+    }
+
+    secrules_close(handle);
+}
 
-    // Copy the rule to the IoctlArgument structure, copying only up to the actual length of the rule
-    memcpy(arg->rule, rule, rule_len);
+// Function to retrieve all the rules and print them, in the given format (SECRULES_FORMAT_*)
+void print_rules(u32 format) {
+    secrules_t *handle = secrules_open();
+    if (!handle) {
+        perror("Failed to open the device");
+        return;
+    }
 
-    // Ensure the last character is a NUL terminator
-    arg->rule[rule_len] = '\0';
+    int ret = secrules_set_read_format(handle, format);
+    if (ret == 0) {
+        fflush(stdout);
+        ret = secrules_dump(handle, STDOUT_FILENO);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Failed to read from the device: %s\n", strerror(-ret));
+    }
 
-    return 0; // Success
+    secrules_close(handle);
 }
 
-// Function to sanitize input and create IoctlReadArgument
-int create_ioctl_read_argument(u32 uid, IoctlReadArgument *arg) {
+// Prints the rules of a user (SECRULES_ALL_USERS for every user) through an open handle
+static void print_user_rules(secrules_t *handle, u32 uid) {
+    char *buffer;
 
-    // Validate that arg is not NULL
-    if (!arg) {
-        fprintf(stderr, "Error: IoctlReadArgument is NULL.\n");
-        return -1;
+    int ret = secrules_read(handle, uid, &buffer, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to read rules via ioctl: %s\n", strerror(-ret));
+        return;
     }
-    
-    // Initialize the IoctlArgument structure
-    memset(arg, 0, sizeof(IoctlReadArgument));
-    arg->uid = uid;
 
-    // Allocate memory for the rules_buffer
-    // Ensure this matches the size expected in the kernel (RULE_BUFFER_SIZE)
-    memset(arg->buffer, 0, BUFFER_SIZE);
+    printf("%s", buffer);
+    free(buffer);
+}
 
-    return 0; // Success
+void print_rules_by_id(u32 uid){
+    secrules_t *handle = secrules_open();
+    if (!handle) {
+        perror("Failed to open the device");
+        return;
+    }
+
+    print_user_rules(handle, uid);
+    secrules_close(handle);
 }
 
-// Function to map command strings to integer values
-int get_command(const char *command) {
-    if (strcmp(command, "print") == 0) return 1;
-    if (strcmp(command, "add") == 0) return 2;
-    if (strcmp(command, "rmv") == 0) return 3;
-    if (strcmp(command, "man") == 0) return 4;
-    return 0; // Unknown command
+// Reports an entry of a batch rejected by the kernel, ctx counts the failures
+static void report_rejected(void *ctx, int line_number, int error) {
+    fprintf(stderr, "Line %d: rule rejected: %s\n", line_number, strerror(error));
+    (*(int *)ctx)++;
 }
 
-// Function to add new rule
-void add_rule(u32 uid, const char *rule) {
-    int fd = open(DEVICE_PATH, O_WRONLY);
-    if (fd < 0) {
+// Parses "<uid> <rule>", the rule points inside line. Returns -1 on a malformed line.
+static int parse_user_rule(char *line, u32 *uid, char **rule) {
+    char *end;
+
+    unsigned long value = strtoul(line, &end, 10);
+    if (end == line || (*end != ' ' && *end != '\t'))
+        return -1;
+
+    *uid = (u32)value;
+    *rule = end + strspn(end, " \t");
+    return 0;
+}
+
+// Function to add all the rules of a file, one "<uid> <rule>" per line ("-" reads stdin).
+// Rules are sent in batches, blank lines and lines starting with '#' are skipped.
+void import_rules(const char *path) {
+    char line[LINE_SIZE];
+    int line_number = 0;
+    int queued = 0;
+    int rejected = 0;
+    int failures = 0;
+
+    FILE *input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!input) {
+        perror("Failed to open the rules file");
+        return;
+    }
+
+    secrules_t *handle = secrules_open();
+    if (!handle) {
         perror("Failed to open the device");
+        if (input != stdin)
+            fclose(input);
         return;
     }
+    secrules_set_reject_handler(handle, report_rejected, &rejected);
+
+    while (fgets(line, sizeof(line), input)) {
+        char *rule;
+        u32 uid;
+
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        if (parse_user_rule(line, &uid, &rule) < 0) {
+            fprintf(stderr, "Line %d: expected \"<uid> <rule>\"\n", line_number);
+            failures++;
+            continue;
+        }
+
+        if (secrules_batch_add(handle, uid, rule, line_number) < 0) {
+            fprintf(stderr, "Line %d: invalid rule\n", line_number);
+            failures++;
+            continue;
+        }
+        queued++;
+    }
+
+    secrules_flush(handle);
+    printf("Imported %d rules, %d failed\n", queued - rejected, failures + rejected);
 
-    struct IoctlArgument arg;
-    int ret = create_ioctl_argument(uid, rule, &arg);
+    secrules_close(handle);
+    if (input != stdin)
+        fclose(input);
+}
+
+// Writes the whole buffer, returns 0 or a negative errno
+static int write_all(int fd, const void *buffer, size_t len) {
+    const char *bytes = buffer;
+
+    while (len > 0) {
+        ssize_t n = write(fd, bytes, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        bytes += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to compile a rules file, in the format of import, into a policy image.
+// The rules are checked here: the image is loaded by the kernel without replaying them.
+void compile_rules(const char *path, const char *output_path) {
+    char line[LINE_SIZE];
+    int line_number = 0;
+    int compiled = 0;
+    int failures = 0;
+    void *buffer;
+    size_t size;
+
+    FILE *input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!input) {
+        perror("Failed to open the rules file");
+        return;
+    }
+
+    secrules_image_t *image = secrules_image_new();
+    if (!image) {
+        perror("Failed to allocate the image");
+        goto out_input;
+    }
+
+    while (fgets(line, sizeof(line), input)) {
+        char *rule;
+        u32 uid;
+
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        if (parse_user_rule(line, &uid, &rule) < 0) {
+            fprintf(stderr, "Line %d: expected \"<uid> <rule>\"\n", line_number);
+            failures++;
+            continue;
+        }
+
+        int ret = secrules_image_add(image, uid, rule);
+        if (ret < 0) {
+            fprintf(stderr, "Line %d: invalid rule: %s\n", line_number, strerror(-ret));
+            failures++;
+            continue;
+        }
+        compiled++;
+    }
+
+    // A partial policy must not replace the production one
+    if (failures > 0) {
+        fprintf(stderr, "%d rules failed, no image written\n", failures);
+        goto out_image;
+    }
+
+    int ret = secrules_image_encode(image, &buffer, &size);
     if (ret < 0) {
-        perror("Bad arguments");
-        return; // Error already logged in create_ioctl_argument
+        fprintf(stderr, "Failed to encode the image: %s\n", strerror(-ret));
+        goto out_image;
     }
 
-    if (ioctl(fd, IOCTL_ADD_RULE, &arg) < 0) {
-        perror("Failed to add rule via ioctl");
+    int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to create the image file");
+    } else {
+        ret = write_all(fd, buffer, size);
+        if (close(fd) < 0 && ret == 0)
+            ret = -errno;
+        if (ret < 0)
+            fprintf(stderr, "Failed to write the image: %s\n", strerror(-ret));
+        else
+            printf("Compiled %d rules, %zu bytes\n", compiled, size);
     }
+    free(buffer);
 
-    close(fd);
+out_image:
+    secrules_image_free(image);
+out_input:
+    if (input != stdin)
+        fclose(input);
 }
 
-// Function to remove a rule from a specific user
-void remove_rule(u32 uid, const char *rule) {
-    int fd = open(DEVICE_PATH, O_WRONLY);
-    if (fd < 0) {
-        perror("Failed to open the device");
+// Function to replace all the rules with a policy image, made by compile or save
+void load_policy(const char *path) {
+    FILE *input = fopen(path, "rb");
+    if (!input) {
+        perror("Failed to open the image file");
         return;
     }
 
-    struct IoctlArgument arg;
-    int ret = create_ioctl_argument(uid, rule, &arg);
-    if (ret < 0) {
-        perror("Bad arguments");
-        return; // Error already logged in create_ioctl_argument
+    char *buffer = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    for (;;) {
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : SECRULES_DUMP_CHUNK;
+            char *larger = realloc(buffer, capacity);
+            if (!larger) {
+                perror("Failed to read the image file");
+                goto out;
+            }
+            buffer = larger;
+        }
+
+        size_t n = fread(buffer + size, 1, capacity - size, input);
+        if (n == 0)
+            break;
+        size += n;
+    }
+    if (ferror(input)) {
+        perror("Failed to read the image file");
+        goto out;
     }
 
-    if (ioctl(fd, IOCTL_REMOVE_RULE, &arg) < 0) {
-        perror("Failed to remove rule via ioctl");
+    secrules_t *handle = secrules_open();
+    if (!handle) {
+        perror("Failed to open the device");
+        goto out;
+    }
+
+    int ret = secrules_load(handle, buffer, size);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to load the image: %s\n", strerror(-ret));
+    } else {
+        printf("Loaded %d rules\n", ret);
     }
+    secrules_close(handle);
 
-    close(fd);
+out:
+    free(buffer);
+    fclose(input);
 }
 
-// Function to retrieve all the rules and the will print that
-void print_rules() {
-    int fd = open(DEVICE_PATH, O_RDONLY);
-    if (fd < 0) {
+// Function to save all the rules as a policy image, loaded back by load
+void save_policy(const char *output_path) {
+    secrules_t *handle = secrules_open();
+    if (!handle) {
         perror("Failed to open the device");
         return;
     }
-    char buffer[BUFFER_SIZE];
-    int bytes_read = read(fd, buffer, BUFFER_SIZE - 1);
-    if (bytes_read < 0) {
-        perror("Failed to read from the device");
-        close(fd);
+
+    int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to create the image file");
+        secrules_close(handle);
         return;
     }
-    buffer[bytes_read] = '\0';
-    printf("%s", buffer);
-    close(fd);
+
+    int ret = secrules_set_read_format(handle, SECRULES_FORMAT_BINARY);
+    if (ret == 0)
+        ret = secrules_dump(handle, fd);
+    if (close(fd) < 0 && ret == 0)
+        ret = -errno;
+    if (ret < 0) {
+        fprintf(stderr, "Failed to save the rules: %s\n", strerror(-ret));
+    }
+
+    secrules_close(handle);
 }
 
-void print_rules_by_id(u32 uid){
-    int fd = open(DEVICE_PATH, O_WRONLY);
-    if (fd < 0) {
+// Function to print the changes of the rules as they happen, in the format SECRULES_FORMAT_DELTA.
+// It starts with all the current rules, then sleeps in poll() until the next change.
+void watch_rules(void) {
+    secrules_t *handle = secrules_open();
+    if (!handle) {
         perror("Failed to open the device");
         return;
     }
 
-    struct IoctlReadArgument arg;
-    int ret = create_ioctl_read_argument(uid, &arg);
-    if (ret < 0) {
-        perror("Bad arguments");
-        return; // Error already logged in create_ioctl_read_argument
+    int ret = secrules_set_read_format(handle, SECRULES_FORMAT_DELTA);
+    while (ret == 0) {
+        ret = secrules_dump(handle, STDOUT_FILENO);
+        if (ret == 0) {
+            ret = secrules_wait(handle, -1);
+            ret = ret < 0 ? ret : 0;
+        }
+    }
+    fprintf(stderr, "Failed to read the changes: %s\n", strerror(-ret));
+
+    secrules_close(handle);
+}
+
+// Applies a stream of commands read from stdin over a single open device:
+// "add <uid> <rule>", "rmv <uid> <rule>", "print [uid]", "flush" and "quit".
+// Consecutive add/rmv commands are sent in batches; print and flush send the pending ones first.
+// When stdin is a terminal every command is applied immediately.
+void run_shell(void) {
+    char line[LINE_SIZE];
+    int interactive = isatty(STDIN_FILENO);
+    int line_number = 0;
+    int queued = 0;
+    int rejected = 0;
+    int failures = 0;
+
+    secrules_t *handle = secrules_open();
+    if (!handle) {
+        perror("Failed to open the device");
+        return;
     }
+    secrules_set_reject_handler(handle, report_rejected, &rejected);
+
+    for (;;) {
+        char *command;
+        char *args;
+        char *rule;
+        u32 uid;
+        int ret;
+
+        if (interactive) {
+            printf("sec> ");
+            fflush(stdout);
+        }
+        if (!fgets(line, sizeof(line), stdin))
+            break;
 
-    if (ioctl(fd, IOCTL_READ_RULES, &arg) < 0) {
-        perror("Failed to add rule via ioctl");
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        command = line + strspn(line, " \t");
+        if (command[0] == '\0' || command[0] == '#')
+            continue;
+
+        args = command + strcspn(command, " \t");
+        if (*args != '\0')
+            *args++ = '\0';
+        args += strspn(args, " \t");
+
+        switch (get_command(command)) {
+            case 1: // print
+                secrules_flush(handle);
+                if (args[0] == '\0') {
+                    print_user_rules(handle, SECRULES_ALL_USERS);
+                } else {
+                    print_user_rules(handle, (u32)atoi(args));
+                }
+                break;
+            case 2: // add
+            case 3: // rmv
+                if (parse_user_rule(args, &uid, &rule) < 0) {
+                    fprintf(stderr, "Line %d: expected \"%s <uid> <rule>\"\n", line_number, command);
+                    failures++;
+                    break;
+                }
+
+                if (get_command(command) == 2) {
+                    ret = secrules_batch_add(handle, uid, rule, line_number);
+                } else {
+                    ret = secrules_batch_remove(handle, uid, rule, line_number);
+                }
+                if (ret < 0) {
+                    fprintf(stderr, "Line %d: invalid rule\n", line_number);
+                    failures++;
+                    break;
+                }
+                queued++;
+
+                if (interactive)
+                    secrules_flush(handle);
+                break;
+            default:
+                if (strcmp(command, "flush") == 0) {
+                    secrules_flush(handle);
+                    break;
+                }
+                if (strcmp(command, "quit") == 0)
+                    goto out;
+
+                fprintf(stderr, "Line %d: unknown command %s\n", line_number, command);
+                failures++;
+                break;
+        }
     }
 
-    printf("%s", arg.buffer);
+out:
+    secrules_flush(handle);
+    if (!interactive)
+        printf("Applied %d commands, %d failed\n", queued - rejected, failures + rejected);
 
-    close(fd);
+    secrules_close(handle);
 }
 
 // Helper function to print the manual
@@ -199,11 +493,25 @@ void print_man() {
     printf("   Usage: sec_tool add <uid> <rule>\n");
     printf("3. rmv - Remove a rule for a specific user ID (uid).\n");
     printf("   Usage: sec_tool rmv <uid> <rule>\n");
+    printf("4. import - Add all the rules of a file, one \"<uid> <rule>\" per line (- for stdin).\n");
+    printf("   Usage: sec_tool import <file>\n");
+    printf("5. shell - Apply the commands read from stdin over one open device: add, rmv, print, flush, quit.\n");
+    printf("   Usage: sec_tool shell < commands\n");
+    printf("6. export - Print all the rules as tab separated \"<uid> <rule>\" lines, for scripts.\n");
+    printf("   Usage: sec_tool export\n");
+    printf("7. compile - Compile a file in the format of import into a policy image, loaded at once.\n");
+    printf("   Usage: sec_tool compile <file> <image>\n");
+    printf("8. load - Replace all the rules with a policy image.\n");
+    printf("   Usage: sec_tool load <image>\n");
+    printf("9. save - Save all the rules as a policy image.\n");
+    printf("   Usage: sec_tool save <image>\n");
+    printf("10. watch - Print every rule, then each change as it happens: +<uid>\\t<rule> or -<uid>\\t<rule>.\n");
+    printf("   Usage: sec_tool watch\n");
 }
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        printf("Usage: %s <print|add|rmv|man> [uid] [rule]\n", argv[0]);
+        printf("Usage: %s <print|add|rmv|import|shell|export|compile|load|save|watch|man> [uid] [rule]\n", argv[0]);
         return -1;
     }
 
@@ -220,7 +528,7 @@ int main(int argc, char *argv[]) {
             }
             else{
                 // Print all the rules
-                print_rules();
+                print_rules(SECRULES_FORMAT_TEXT);
             }
 
             break;
@@ -241,6 +549,47 @@ int main(int argc, char *argv[]) {
         case 4: // man
             print_man();
             break;
+        case 5: // import
+            if (argc != 3) {
+                printf("Usage: %s import <file>\n", argv[0]);
+                return -1;
+            }
+            import_rules(argv[2]);
+            break;
+        case 6: // shell
+            run_shell();
+            break;
+        case 7: // export
+            if (argc != 2) {
+                printf("Usage: %s export\n", argv[0]);
+                return -1;
+            }
+            print_rules(SECRULES_FORMAT_TSV);
+            break;
+        case 8: // compile
+            if (argc != 4) {
+                printf("Usage: %s compile <file> <image>\n", argv[0]);
+                return -1;
+            }
+            compile_rules(argv[2], argv[3]);
+            break;
+        case 9: // load
+            if (argc != 3) {
+                printf("Usage: %s load <image>\n", argv[0]);
+                return -1;
+            }
+            load_policy(argv[2]);
+            break;
+        case 10: // save
+            if (argc != 3) {
+                printf("Usage: %s save <image>\n", argv[0]);
+                return -1;
+            }
+            save_policy(argv[2]);
+            break;
+        case 11: // watch
+            watch_rules();
+            break;
         default:
             printf("Unknown command %s\n", argv[1]);
             return -1;
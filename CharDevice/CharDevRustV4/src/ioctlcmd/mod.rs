@@ -5,13 +5,15 @@
 use kernel::uaccess::*;
 use kernel::ioctl::*;
 use core::ptr::{addr_of_mut};
-use kernel::{str::CString, fmt};
+use kernel::str::CString;
 use kernel::prelude::*;
+use kernel::sync::{new_mutex, Mutex};
 use core::mem::MaybeUninit;
 
 pub(crate) mod structures;
-use crate::ioctlcmd::structures::constant::{RULE_SIZE,RULE_BUFFER_SIZE};
-use crate::ioctlcmd::structures::{UserRuleStore,UserRule};
+use crate::ioctlcmd::structures::constant::{RULE_SIZE,RULE_BUFFER_SIZE,IOCTL_BATCH_MAX};
+use crate::ioctlcmd::structures::{UserRuleStore,UserRule,BatchEntry,Change};
+use crate::ioctlcmd::structures::image::{self, ImageSource};
 
 // Declare the external variable
 extern "Rust" {
@@ -24,6 +26,30 @@ const IOCTL_MAGIC: u32 = b's' as u32; // Unique magic number
 const IOCTL_ADD_RULE: u32 = _IOW::<IoctlArgument>(IOCTL_MAGIC, 1);
 const IOCTL_REMOVE_RULE: u32 = _IOW::<IoctlArgument>(IOCTL_MAGIC, 2);
 const IOCTL_READ_RULES: u32 = _IOR::<IoctlReadArgument>(IOCTL_MAGIC, 3);
+const IOCTL_ADD_RULES: u32 = _IOWR::<IoctlBatchArgument>(IOCTL_MAGIC, 4);
+const IOCTL_REMOVE_RULES: u32 = _IOWR::<IoctlBatchArgument>(IOCTL_MAGIC, 5);
+
+// Version 2 of the single rule commands: the payloads are passed by pointer and length
+const IOCTL_ADD_RULE_V2: u32 = _IOW::<IoctlRuleArgumentV2>(IOCTL_MAGIC, 6);
+const IOCTL_REMOVE_RULE_V2: u32 = _IOW::<IoctlRuleArgumentV2>(IOCTL_MAGIC, 7);
+const IOCTL_READ_RULES_V2: u32 = _IOWR::<IoctlReadArgumentV2>(IOCTL_MAGIC, 8);
+
+// Selects the format of the rules returned by read() on the file, the argument points to a u32
+const IOCTL_SET_READ_FORMAT: u32 = _IOW::<u32>(IOCTL_MAGIC, 9);
+
+// Replaces all the rules with the ones of a policy image (see structures/image)
+const IOCTL_LOAD_POLICY: u32 = _IOWR::<IoctlPolicyArgument>(IOCTL_MAGIC, 10);
+
+/// Human readable blocks, one per user (the default).
+const READ_FORMAT_TEXT: u32 = 0;
+/// One "<uid>\t<rule>\n" line per rule; backslash, tab and newline in the rule are escaped.
+const READ_FORMAT_TSV: u32 = 1;
+/// The policy image of the whole store, the format loaded by `IOCTL_LOAD_POLICY`.
+const READ_FORMAT_BINARY: u32 = 2;
+/// The changes since the last read of the file: "+<uid>\t<rule>\n" for an added rule,
+/// "-<uid>\t<rule>\n" for a removed one, escaped as `READ_FORMAT_TSV`. A "*\n" line means
+/// that the reader must forget every rule, the whole store follows as added rules.
+const READ_FORMAT_DELTA: u32 = 3;
 
 
 #[repr(C)]
@@ -34,57 +60,47 @@ struct IoctlArgument {
 
 // Methods for IoctlArgument
 impl IoctlArgument {    
-    // Helper function to create a CString from the rule field in IoctlArgument
-    fn create_cstring_from_rule(&self) -> Result<CString, Error> {
-        // Find the length of the rule by identifying the first NUL byte
+    /// Bytes of the rule, up to its NUL byte or to the end of the array.
+    fn rule_bytes(&self) -> &[u8] {
         let rule_len = self.rule.iter().position(|&byte| byte == 0).unwrap_or(RULE_SIZE);
+        &self.rule[..rule_len]
+    }
 
-        //pr_info!("The corresponding rule len is: {}",rule_len);
-            
-       // Allocate a new vector with enough space for the rule and a null terminator
-       let mut rule_with_null = Vec::with_capacity(rule_len + 1, GFP_KERNEL).expect("Impossible to alloc vector");
-
-       // Copy the original rule data into the vector
-       for &byte in &self.rule[..rule_len] {
-           if let Err(e) = rule_with_null.push(byte, GFP_KERNEL){
-                pr_err!("Failed during rule copy: {:?}\n", e);
-                return Err(ENOMEM);
+    // Helper function to get the rule field in IoctlArgument as a CStr, without allocating
+    fn rule_cstr<'a>(&'a self, buffer: &'a mut [u8; RULE_SIZE + 1]) -> Result<&'a CStr, Error> {
+        // Find the length of the rule by identifying the first NUL byte
+        match self.rule.iter().position(|&byte| byte == 0) {
+            // The terminator is part of the argument, the rule is used in place
+            Some(rule_len) => rule_from_bytes(&self.rule[..=rule_len]),
+            None => {
+                // A rule using the whole array has no terminator, add it in the caller's buffer
+                buffer[..RULE_SIZE].copy_from_slice(&self.rule);
+                buffer[RULE_SIZE] = 0;
+                rule_from_bytes(&buffer[..])
             }
-       }
-
-       // Ensure the vector is null-terminated
-       if let Err(e) = rule_with_null.push(0, GFP_KERNEL){
-            pr_err!("Failed to append null byte {:?}\n", e);
-            return Err(ENOMEM);
-       }
+        }
+    }
+}
 
-        // Attempt to create a CStr from the bytes array
-        let cstr = match CStr::from_bytes_with_nul(&rule_with_null) {
-            Ok(cstr) => cstr,
-            Err(e) => {
-                pr_err!("Failed to create CStr from bytes: {:?} \nThe error is: {:?}", rule_with_null,e);
-                return Err(EINVAL); // Return EINVAL on error
-            }
-        };
+/// Checks that the bytes of a rule, without the NUL byte, are valid UTF-8.
+fn validate_rule(rule: &[u8]) -> Result<(), Error> {
+    if let Err(e) = core::str::from_utf8(rule) {
+        pr_err!("The rule is not a valid UTF-8 string: {:?}\n", e);
+        return Err(EINVAL);
+    }
+    Ok(())
+}
 
-        // Convert CStr to &str; handle UTF-8 validation
-        let rule_str = match cstr.to_str() {
-            Ok(s) => s,
-            Err(e) => {
-                pr_err!("Failed to convert CStr to str: {:?}", e);
-                return Err(EINVAL); // Return EINVAL on UTF-8 error
-            }
-        };
+/// Validates the bytes of a rule and returns them as a CStr, without copying them.
+///
+/// `rule_with_null` must end with the first NUL byte of the rule, that callers already look
+/// for to find its length: only the UTF-8 validation is left. The store copies the rule
+/// once, when it is interned.
+fn rule_from_bytes(rule_with_null: &[u8]) -> Result<&CStr, Error> {
+    validate_rule(&rule_with_null[..rule_with_null.len() - 1])?;
 
-        // Create CString using try_from_fmt with formatting
-        match CString::try_from_fmt(fmt!("{}", rule_str)) {
-            Ok(cstring) => Ok(cstring),
-            Err(e) => {
-                pr_err!("Failed to create CString using try_from_fmt: {:?}", e);
-                Err(EINVAL) // Return EINVAL on CString creation error
-            }
-        }
-    }
+    // SAFETY: the slice ends with a NUL byte and, as required to the callers, it is the only one.
+    Ok(unsafe { CStr::from_bytes_with_nul_unchecked(rule_with_null) })
 }
 
 #[repr(C)]
@@ -93,6 +109,44 @@ struct IoctlReadArgument {
     rules_buffer: [u8; RULE_BUFFER_SIZE], // Buffer to store rules
 }
 
+/// Argument of `IOCTL_ADD_RULE_V2` and `IOCTL_REMOVE_RULE_V2`: only `rule_len` bytes are copied.
+#[repr(C)]
+struct IoctlRuleArgumentV2 {
+    uid: u32,        // User ID
+    rule_len: u32,   // Length of the rule, without NUL terminator, at most RULE_SIZE
+    rule: u64,       // User pointer to the rule string
+}
+
+/// Argument of `IOCTL_READ_RULES_V2`.
+///
+/// `buffer_len` is the size of the user buffer on input and the size of the rules on output:
+/// if the buffer is too small nothing is copied, the command fails with `ENOSPC` and
+/// `buffer_len` tells the caller the size to retry with.
+#[repr(C)]
+struct IoctlReadArgumentV2 {
+    uid: u32,         // User ID (MAX U32 to read the rules of every user)
+    buffer_len: u32,  // Size of the buffer in input, size of the rules in output
+    buffer: u64,      // User pointer to the output buffer
+}
+
+/// Argument of the batched commands: `entries` and `status` are user pointers to arrays
+/// of `count` elements, applied while taking the store lock only once.
+#[repr(C)]
+struct IoctlBatchArgument {
+    count: u32,      // Number of entries, at most IOCTL_BATCH_MAX
+    applied: u32,    // Set by the kernel: number of entries applied successfully
+    entries: u64,    // Array of IoctlArgument
+    status: u64,     // Array of i32 set by the kernel: 0 or a negative errno for each entry (optional)
+}
+
+/// Argument of `IOCTL_LOAD_POLICY`.
+#[repr(C)]
+struct IoctlPolicyArgument {
+    size: u32,       // Size of the image
+    rules: u32,      // Set by the kernel: number of rules loaded
+    image: u64,      // User pointer to the image
+}
+
 //--------------- IOCTL HANDLERS ---------------
 
 /// Handles IOCTL commands for managing user-defined security rules.
@@ -103,6 +157,11 @@ struct IoctlReadArgument {
 /// - `IOCTL_ADD_RULE`: Adds a rule for a given user ID.
 /// - `IOCTL_REMOVE_RULE`: Removes a rule for a given user ID.
 /// - `IOCTL_READ_RULES`: Retrieves rules for a specific user ID.
+/// - `IOCTL_ADD_RULES`/`IOCTL_REMOVE_RULES`: Adds or removes a batch of rules.
+/// - `IOCTL_ADD_RULE_V2`/`IOCTL_REMOVE_RULE_V2`/`IOCTL_READ_RULES_V2`: Same as the
+///   single rule commands, with payloads of variable length.
+/// - `IOCTL_SET_READ_FORMAT`: Selects the format of read() on the file.
+/// - `IOCTL_LOAD_POLICY`: Replaces all the rules with a policy image.
 ///
 /// # Parameters
 ///
@@ -136,13 +195,13 @@ struct IoctlReadArgument {
 /// 
 #[no_mangle]
 pub(crate) extern "C" fn rust_ioctl(
-    _file: *mut core::ffi::c_void,
+    file_data: *mut core::ffi::c_void,
     cmd: u32,
     arg: *mut core::ffi::c_void,
 ) -> isize {
     if arg.is_null() {
         pr_err!("IOCTL Called without argument\n");
-        return -EINVAL.to_errno() as isize;
+        return EINVAL.to_errno() as isize;
     }
 
     match cmd {
@@ -156,18 +215,19 @@ pub(crate) extern "C" fn rust_ioctl(
 
                 if reader.read_raw(&mut buffer).is_err() {
                     pr_err!("Failed to read from user space for ADD/REMOVE IOCTL\n");
-                    return -EFAULT.to_errno() as isize;
+                    return EFAULT.to_errno() as isize;
                 }
 
                 core::ptr::read(buffer.as_ptr() as *const IoctlArgument)
             };
 
             let uid = ioctl_arg.uid;
-            let rule_str = match ioctl_arg.create_cstring_from_rule() {
-                Ok(cstring) => cstring,
+            let mut rule_buffer = [0u8; RULE_SIZE + 1];
+            let rule_str = match ioctl_arg.rule_cstr(&mut rule_buffer) {
+                Ok(rule) => rule,
                 Err(e) => {
                     pr_err!("Failed to construct rule string: {:?}\n", e);
-                    return -EINVAL.to_errno() as isize;
+                    return EINVAL.to_errno() as isize;
                 }
             };
 
@@ -178,7 +238,7 @@ pub(crate) extern "C" fn rust_ioctl(
                     Some(store) => store,
                     None => {
                         pr_err!("USER_RULE_STORE not initialized\n");
-                        return -EINVAL.to_errno() as isize;
+                        return EINVAL.to_errno() as isize;
                     }
                 }
             };
@@ -187,13 +247,13 @@ pub(crate) extern "C" fn rust_ioctl(
                 IOCTL_ADD_RULE => {
                     if let Err(e) = user_rule_store.add_rule(uid, rule_str) {
                         pr_err!("Failed to add rule: {:?}\n", e);
-                        return -EFAULT.to_errno() as isize;
+                        return EFAULT.to_errno() as isize;
                     }
                 }
                 IOCTL_REMOVE_RULE => {
                     if let Err(e) = user_rule_store.remove_rule(uid, rule_str) {
                         pr_err!("Failed to remove rule: {:?}\n", e);
-                        return -EFAULT.to_errno() as isize;
+                        return EFAULT.to_errno() as isize;
                     }
                 }
                 _ => unreachable!(),
@@ -210,7 +270,7 @@ pub(crate) extern "C" fn rust_ioctl(
 
                 if reader.read_raw(&mut buffer).is_err() {
                     pr_err!("Failed to read from user space for READ IOCTL\n");
-                    return -EFAULT.to_errno() as isize;
+                    return EFAULT.to_errno() as isize;
                 }
 
                 core::ptr::read(buffer.as_ptr() as *const IoctlReadArgument)
@@ -221,22 +281,22 @@ pub(crate) extern "C" fn rust_ioctl(
                 let store_ptr = addr_of_mut!(USER_RULE_STORE);
                 match (*store_ptr).as_ref() {
                     Some(store) => match store.get_rules_by_id(ioctl_read_arg.uid) {
-                        Ok(rules) => rules, // Borrow the rules list
+                        Ok(rules) => rules, // Shared snapshot, nothing is copied
                         Err(e) => {
                             pr_err!("Failed to get rules for UID: {}\n{:?}",ioctl_read_arg.uid, e);
-                            return -EINVAL.to_errno() as isize;
+                            return EINVAL.to_errno() as isize;
                         }
                     },
                     None => {
                         pr_err!("USER_RULE_STORE not initialized\n");
-                        return -EINVAL.to_errno() as isize;
+                        return EINVAL.to_errno() as isize;
                     }
                 }
             };
 
             let mut output : Vec<u8> = Vec::new();
             if let Some(user_rule) = rules {
-                if let Err(e) = pretty_print_rules(user_rule, &mut output){
+                if let Err(e) = pretty_print_rules(&user_rule, &mut output){
                     return e.to_errno() as isize;
                 }
             }
@@ -257,58 +317,568 @@ pub(crate) extern "C" fn rust_ioctl(
             // Write the kernel buffer to the user's buffer
             if let Err(e) = writer.write_slice(&ioctl_read_arg.rules_buffer[..output_len]) {
                 pr_err!("Failed to write back to user space for READ IOCTL: {:?}\n", e);
-                return -EFAULT.to_errno() as isize;
+                return EFAULT.to_errno() as isize;
             }
         }
 
+        IOCTL_ADD_RULES | IOCTL_REMOVE_RULES => {
+            return rust_ioctl_batch(cmd, arg);
+        }
+
+        IOCTL_ADD_RULE_V2 | IOCTL_REMOVE_RULE_V2 => {
+            return rust_ioctl_rule_v2(cmd, arg);
+        }
+
+        IOCTL_READ_RULES_V2 => {
+            return rust_ioctl_read_v2(arg);
+        }
+
+        IOCTL_SET_READ_FORMAT => {
+            return rust_ioctl_set_read_format(file_data, arg);
+        }
+
+        IOCTL_LOAD_POLICY => {
+            return rust_ioctl_load_policy(arg);
+        }
+
         _ => {
             pr_err!("Unknown IOCTL command\n");
-            return -EINVAL.to_errno() as isize;
+            return EINVAL.to_errno() as isize;
         }
     }
 
     0
 }
 
+/// Returns the global rule store, if initialized.
+fn user_rule_store() -> Option<&'static UserRuleStore> {
+    // SAFETY: the store is set once by the module init, before the device is created,
+    // and it is cleared only after the device is removed.
+    unsafe {
+        let store_ptr = addr_of_mut!(USER_RULE_STORE);
+        (*store_ptr).as_deref()
+    }
+}
+
+/// Handles `IOCTL_ADD_RULE_V2` and `IOCTL_REMOVE_RULE_V2`.
+fn rust_ioctl_rule_v2(cmd: u32, arg: *mut core::ffi::c_void) -> isize {
+    // Safely copy the IoctlRuleArgumentV2 from user space
+    let ioctl_arg = unsafe {
+        let mut buffer: [MaybeUninit<u8>; core::mem::size_of::<IoctlRuleArgumentV2>()] = MaybeUninit::uninit().assume_init();
+        let user_slice = UserSlice::new(arg as usize, buffer.len());
+        let mut reader = user_slice.reader();
+
+        if reader.read_raw(&mut buffer).is_err() {
+            pr_err!("Failed to read from user space for ADD/REMOVE V2 IOCTL\n");
+            return EFAULT.to_errno() as isize;
+        }
+
+        core::ptr::read(buffer.as_ptr() as *const IoctlRuleArgumentV2)
+    };
+
+    let rule_len = ioctl_arg.rule_len as usize;
+    if rule_len > RULE_SIZE {
+        pr_err!("Rule of {} bytes exceeds the limit of {}\n", rule_len, RULE_SIZE);
+        return E2BIG.to_errno() as isize;
+    }
+
+    // Copy only the bytes of the rule, the buffer keeps a NUL byte right after them
+    let mut rule = [0u8; RULE_SIZE + 1];
+    let mut reader = UserSlice::new(ioctl_arg.rule as usize, rule_len).reader();
+    if reader.read_slice(&mut rule[..rule_len]).is_err() {
+        pr_err!("Failed to read the rule from user space\n");
+        return EFAULT.to_errno() as isize;
+    }
+
+    if rule[..rule_len].contains(&0) {
+        pr_err!("The rule contains a NUL byte\n");
+        return EINVAL.to_errno() as isize;
+    }
+
+    let rule_str = match rule_from_bytes(&rule[..=rule_len]) {
+        Ok(rule) => rule,
+        Err(e) => {
+            pr_err!("Failed to construct rule string: {:?}\n", e);
+            return EINVAL.to_errno() as isize;
+        }
+    };
+
+    let user_rule_store = match user_rule_store() {
+        Some(store) => store,
+        None => {
+            pr_err!("USER_RULE_STORE not initialized\n");
+            return EINVAL.to_errno() as isize;
+        }
+    };
+
+    let result = match cmd {
+        IOCTL_ADD_RULE_V2 => user_rule_store.add_rule(ioctl_arg.uid, rule_str),
+        IOCTL_REMOVE_RULE_V2 => user_rule_store.remove_rule(ioctl_arg.uid, rule_str),
+        _ => unreachable!(),
+    };
+
+    match result {
+        Ok(()) => 0,
+        Err(e) => {
+            pr_err!("Failed to update the rules of UID {}: {:?}\n", ioctl_arg.uid, e);
+            e.to_errno() as isize
+        }
+    }
+}
+
+/// Handles `IOCTL_READ_RULES_V2`.
+///
+/// The rules are rendered as for `IOCTL_READ_RULES`, but they are never truncated:
+/// if they don't fit the buffer the required size is returned with `ENOSPC`.
+fn rust_ioctl_read_v2(arg: *mut core::ffi::c_void) -> isize {
+    // Safely copy the IoctlReadArgumentV2 from user space
+    let ioctl_read_arg = unsafe {
+        let mut buffer: [MaybeUninit<u8>; core::mem::size_of::<IoctlReadArgumentV2>()] = MaybeUninit::uninit().assume_init();
+        let user_slice = UserSlice::new(arg as usize, buffer.len());
+        let mut reader = user_slice.reader();
+
+        if reader.read_raw(&mut buffer).is_err() {
+            pr_err!("Failed to read from user space for READ V2 IOCTL\n");
+            return EFAULT.to_errno() as isize;
+        }
+
+        core::ptr::read(buffer.as_ptr() as *const IoctlReadArgumentV2)
+    };
+
+    let user_rule_store = match user_rule_store() {
+        Some(store) => store,
+        None => {
+            pr_err!("USER_RULE_STORE not initialized\n");
+            return EINVAL.to_errno() as isize;
+        }
+    };
+
+    let mut output : Vec<u8> = Vec::new();
+    if ioctl_read_arg.uid == u32::MAX {
+        let rules = match user_rule_store.get_all_rules() {
+            Ok(rules) => rules,
+            Err(e) => return e.to_errno() as isize,
+        };
+        for user_rule in rules.iter() {
+            if let Err(e) = pretty_print_rules(user_rule, &mut output) {
+                return e.to_errno() as isize;
+            }
+        }
+    } else {
+        let user_rule = match user_rule_store.get_rules_by_id(ioctl_read_arg.uid) {
+            Ok(Some(user_rule)) => user_rule,
+            Ok(None) => return EINVAL.to_errno() as isize,
+            Err(e) => return e.to_errno() as isize,
+        };
+        if let Err(e) = pretty_print_rules(&user_rule, &mut output) {
+            return e.to_errno() as isize;
+        }
+    }
+
+    if output.len() > u32::MAX as usize {
+        return E2BIG.to_errno() as isize;
+    }
+    let fits = output.len() <= ioctl_read_arg.buffer_len as usize;
+
+    if fits {
+        let mut writer = UserSlice::new(ioctl_read_arg.buffer as usize, output.len()).writer();
+        if let Err(e) = writer.write_slice(&output) {
+            pr_err!("Failed to write back to user space for READ V2 IOCTL: {:?}\n", e);
+            return EFAULT.to_errno() as isize;
+        }
+    }
+
+    // Moves u32 size forward to match the addr of buffer_len inside the IoctlReadArgumentV2.
+    let len_ptr = arg as usize + core::mem::size_of::<u32>();
+    let mut writer = UserSlice::new(len_ptr, core::mem::size_of::<u32>()).writer();
+    if writer.write_slice(&(output.len() as u32).to_ne_bytes()).is_err() {
+        pr_err!("Failed to write the rules size to user space\n");
+        return EFAULT.to_errno() as isize;
+    }
+
+    if fits {
+        0
+    } else {
+        ENOSPC.to_errno() as isize
+    }
+}
+
+/// Handles `IOCTL_ADD_RULES` and `IOCTL_REMOVE_RULES`.
+///
+/// All the entries are copied and validated first, then they are applied under a
+/// single acquisition of the store lock. The command fails only if the batch itself
+/// can't be read, the result of each entry is reported through the `status` array.
+fn rust_ioctl_batch(cmd: u32, arg: *mut core::ffi::c_void) -> isize {
+    // Safely copy the IoctlBatchArgument from user space
+    let batch_arg = unsafe {
+        let mut buffer: [MaybeUninit<u8>; core::mem::size_of::<IoctlBatchArgument>()] = MaybeUninit::uninit().assume_init();
+        let user_slice = UserSlice::new(arg as usize, buffer.len());
+        let mut reader = user_slice.reader();
+
+        if reader.read_raw(&mut buffer).is_err() {
+            pr_err!("Failed to read from user space for BATCH IOCTL\n");
+            return EFAULT.to_errno() as isize;
+        }
+
+        core::ptr::read(buffer.as_ptr() as *const IoctlBatchArgument)
+    };
+
+    let count = batch_arg.count as usize;
+    if count > IOCTL_BATCH_MAX {
+        pr_err!("Batch of {} rules exceeds the limit of {}\n", count, IOCTL_BATCH_MAX);
+        return EINVAL.to_errno() as isize;
+    }
+
+    // The valid rules are copied one after the other in `strings`, each followed by its
+    // NUL byte, and the entries borrow them: the rules are not allocated one by one.
+    let mut strings: Vec<u8> = Vec::new();
+    // Per entry: the UID and the end of its rule in `strings`, or the error of the entry
+    let mut spans: Vec<(u32, Result<usize, i32>)> = match Vec::with_capacity(count, GFP_KERNEL) {
+        Ok(spans) => spans,
+        Err(_) => return ENOMEM.to_errno() as isize,
+    };
+
+    // Copy the entries one by one, a malformed rule only fails its own entry
+    let entries_slice = UserSlice::new(batch_arg.entries as usize, count * core::mem::size_of::<IoctlArgument>());
+    let mut reader = entries_slice.reader();
+    for _ in 0..count {
+        let ioctl_arg = unsafe {
+            let mut buffer: [MaybeUninit<u8>; core::mem::size_of::<IoctlArgument>()] = MaybeUninit::uninit().assume_init();
+
+            if reader.read_raw(&mut buffer).is_err() {
+                pr_err!("Failed to read the batch entries from user space\n");
+                return EFAULT.to_errno() as isize;
+            }
+
+            core::ptr::read(buffer.as_ptr() as *const IoctlArgument)
+        };
+
+        let rule = ioctl_arg.rule_bytes();
+        let span = match validate_rule(rule) {
+            Ok(()) => {
+                if strings.extend_from_slice(rule, GFP_KERNEL).is_err() || strings.push(0, GFP_KERNEL).is_err() {
+                    return ENOMEM.to_errno() as isize;
+                }
+                Ok(strings.len())
+            }
+            Err(e) => Err(e.to_errno()),
+        };
+
+        if spans.push((ioctl_arg.uid, span), GFP_KERNEL).is_err() {
+            return ENOMEM.to_errno() as isize;
+        }
+    }
+
+    let mut entries = match Vec::with_capacity(count, GFP_KERNEL) {
+        Ok(entries) => entries,
+        Err(_) => return ENOMEM.to_errno() as isize,
+    };
+
+    let mut start = 0;
+    for &(uid, span) in spans.iter() {
+        let entry = match span {
+            Ok(end) => {
+                // SAFETY: `strings[start..end]` is a rule without NUL bytes followed by its
+                // NUL byte, copied above.
+                let rule = unsafe { CStr::from_bytes_with_nul_unchecked(&strings[start..end]) };
+                start = end;
+                BatchEntry { uid, rule: Some(rule), status: 0 }
+            }
+            Err(status) => BatchEntry { uid, rule: None, status },
+        };
+
+        // The capacity has been reserved above
+        if entries.push(entry, GFP_KERNEL).is_err() {
+            return ENOMEM.to_errno() as isize;
+        }
+    }
+
+    // Safely access the USER_RULE_STORE
+    let user_rule_store = unsafe {
+        let store_ptr = addr_of_mut!(USER_RULE_STORE);
+        match (*store_ptr).as_ref() {
+            Some(store) => store,
+            None => {
+                pr_err!("USER_RULE_STORE not initialized\n");
+                return EINVAL.to_errno() as isize;
+            }
+        }
+    };
+
+    let applied = match cmd {
+        IOCTL_ADD_RULES => user_rule_store.add_rules(&mut entries),
+        IOCTL_REMOVE_RULES => user_rule_store.remove_rules(&mut entries),
+        _ => unreachable!(),
+    };
+
+    // Report the outcome of every entry
+    if batch_arg.status != 0 {
+        let status_slice = UserSlice::new(batch_arg.status as usize, count * core::mem::size_of::<i32>());
+        let mut writer = status_slice.writer();
+        for entry in entries.iter() {
+            if writer.write_slice(&entry.status.to_ne_bytes()).is_err() {
+                pr_err!("Failed to write the batch status to user space\n");
+                return EFAULT.to_errno() as isize;
+            }
+        }
+    }
+
+    // Moves u32 size forward to match the addr of applied inside the IoctlBatchArgument.
+    let applied_ptr = arg as usize + core::mem::size_of::<u32>();
+    let mut writer = UserSlice::new(applied_ptr, core::mem::size_of::<u32>()).writer();
+    if writer.write_slice(&(applied as u32).to_ne_bytes()).is_err() {
+        pr_err!("Failed to write the batch result to user space\n");
+        return EFAULT.to_errno() as isize;
+    }
+
+    0
+}
+
+/// Handles `IOCTL_SET_READ_FORMAT`, the format applies to the following reads of the file.
+fn rust_ioctl_set_read_format(file_data: *mut core::ffi::c_void, arg: *mut core::ffi::c_void) -> isize {
+    if file_data.is_null() {
+        return EINVAL.to_errno() as isize;
+    }
+
+    let mut buffer = [0u8; core::mem::size_of::<u32>()];
+    let mut reader = UserSlice::new(arg as usize, buffer.len()).reader();
+    if reader.read_slice(&mut buffer).is_err() {
+        pr_err!("Failed to read from user space for SET READ FORMAT IOCTL\n");
+        return EFAULT.to_errno() as isize;
+    }
+
+    let format = u32::from_ne_bytes(buffer);
+    if format > READ_FORMAT_DELTA {
+        return EINVAL.to_errno() as isize;
+    }
+
+    // SAFETY: the pointer comes from `rust_open_file` and it lives until the file is released.
+    let state = unsafe { &*(file_data as *const Mutex<FileState>) };
+    let mut state = state.lock();
+    if state.format != format {
+        state.format = format;
+        // The next read renders the rules again, from the start
+        state.rendered = false;
+        state.output.clear();
+        state.cursor = None;
+        state.delta_pos = 0;
+    }
+
+    0
+}
+
+/// Size of the chunks copied from user space while reading a policy image.
+const USER_IMAGE_CHUNK: usize = 512;
+
+/// A policy image in user memory, copied in small chunks while the store is built.
+struct UserImage {
+    reader: UserSliceReader,
+    buffer: [u8; USER_IMAGE_CHUNK],
+    start: usize,
+    end: usize,
+}
+
+impl ImageSource for UserImage {
+    fn remaining(&self) -> usize {
+        self.end - self.start + self.reader.len()
+    }
+
+    fn read(&mut self, out: &mut [u8]) -> Result<(), Error> {
+        if out.len() > self.remaining() {
+            return Err(EINVAL);
+        }
+
+        let mut done = 0;
+        while done < out.len() {
+            if self.start == self.end {
+                let len = core::cmp::min(USER_IMAGE_CHUNK, self.reader.len());
+                self.reader.read_slice(&mut self.buffer[..len])?;
+                self.start = 0;
+                self.end = len;
+            }
+
+            let len = core::cmp::min(out.len() - done, self.end - self.start);
+            out[done..done + len].copy_from_slice(&self.buffer[self.start..self.start + len]);
+            self.start += len;
+            done += len;
+        }
+        Ok(())
+    }
+}
+
+/// Handles `IOCTL_LOAD_POLICY`: on error the current rules are kept.
+fn rust_ioctl_load_policy(arg: *mut core::ffi::c_void) -> isize {
+    let mut buffer = [0u8; core::mem::size_of::<IoctlPolicyArgument>()];
+    let mut reader = UserSlice::new(arg as usize, buffer.len()).reader();
+    if reader.read_slice(&mut buffer).is_err() {
+        pr_err!("Failed to read from user space for LOAD POLICY IOCTL\n");
+        return EFAULT.to_errno() as isize;
+    }
+    // SAFETY: the buffer has the size of the argument, every bit pattern is valid.
+    let policy_arg = unsafe { core::ptr::read_unaligned(buffer.as_ptr() as *const IoctlPolicyArgument) };
+
+    let user_rule_store = match user_rule_store() {
+        Some(store) => store,
+        None => {
+            pr_err!("USER_RULE_STORE not initialized\n");
+            return EINVAL.to_errno() as isize;
+        }
+    };
+
+    let mut source = UserImage {
+        reader: UserSlice::new(policy_arg.image as usize, policy_arg.size as usize).reader(),
+        buffer: [0u8; USER_IMAGE_CHUNK],
+        start: 0,
+        end: 0,
+    };
+    let rules = match user_rule_store.load_image(&mut source) {
+        Ok(rules) => rules,
+        Err(e) => {
+            pr_err!("Failed to load the policy image: {:?}\n", e);
+            return e.to_errno() as isize;
+        }
+    };
+
+    // Moves u32 size forward to match the addr of rules inside the IoctlPolicyArgument.
+    let rules_ptr = arg as usize + core::mem::size_of::<u32>();
+    let mut writer = UserSlice::new(rules_ptr, core::mem::size_of::<u32>()).writer();
+    if writer.write_slice(&(rules as u32).to_ne_bytes()).is_err() {
+        pr_err!("Failed to write the number of rules to user space\n");
+        return EFAULT.to_errno() as isize;
+    }
+
+    0
+}
+
 //--------------- READ ---------------
 
+/// State of an open `/dev/secrules` file.
+///
+/// The rules are rendered once per version of the store: the following reads only
+/// copy the requested chunk, so a sequential read is linear in the size of the output.
+struct FileState {
+    /// Version of the store rendered in `output`.
+    generation: u64,
+    /// False until the first read renders the rules.
+    rendered: bool,
+    /// `READ_FORMAT_TEXT`, `READ_FORMAT_TSV`, `READ_FORMAT_BINARY` or `READ_FORMAT_DELTA`.
+    format: u32,
+    output: Vec<u8>,
+    /// `READ_FORMAT_DELTA` only: generation of the last change rendered in `output`
+    /// (`None` until the first read, that renders the whole store), and position of the
+    /// first byte of `output` not read yet.
+    cursor: Option<u64>,
+    delta_pos: usize,
+}
+
+impl FileState {
+    const fn new() -> Self {
+        Self {
+            generation: 0,
+            rendered: false,
+            format: READ_FORMAT_TEXT,
+            output: Vec::new(),
+            cursor: None,
+            delta_pos: 0,
+        }
+    }
+}
+
+/// Allocates the state of a new open file, returns NULL on failure.
+#[no_mangle]
+pub(crate) extern "C" fn rust_open_file() -> *mut core::ffi::c_void {
+    match Box::pin_init(new_mutex!(FileState::new()), GFP_KERNEL) {
+        // SAFETY: the state is never moved out of the box, it is only accessed through the raw pointer.
+        Ok(state) => Box::into_raw(unsafe { Pin::into_inner_unchecked(state) }) as *mut core::ffi::c_void,
+        Err(e) => {
+            pr_err!("Failed to allocate the file state: {:?}\n", e);
+            core::ptr::null_mut()
+        }
+    }
+}
+
+/// Releases the state allocated by `rust_open_file`.
+#[no_mangle]
+pub(crate) extern "C" fn rust_release_file(file_data: *mut core::ffi::c_void) {
+    if !file_data.is_null() {
+        // SAFETY: the pointer comes from `rust_open_file` and the file is being released.
+        drop(unsafe { Box::from_raw(file_data as *mut Mutex<FileState>) });
+    }
+}
+
 #[no_mangle]
 pub(crate) extern "C" fn rust_read(
-    _file: *mut core::ffi::c_void,
+    file_data: *mut core::ffi::c_void,
     user_buffer: *mut u8,
     count: usize,
     offset: *mut u64,
 ) -> isize {
+    if file_data.is_null() {
+        return EINVAL.to_errno() as isize;
+    }
+
+    // SAFETY: the pointer comes from `rust_open_file` and it lives until the file is released.
+    let state = unsafe { &*(file_data as *const Mutex<FileState>) };
+    let mut state = state.lock();
+
+    // The deltas are a stream: every read continues from the last one, whatever the offset
+    if state.format == READ_FORMAT_DELTA {
+        return read_changes(&mut state, user_buffer, count, offset);
+    }
+
     // Convert the offset to usize
     let current_offset = unsafe { *offset as usize };
 
-    // Safely access the global USER_RULE_STORE
-    let rules = unsafe {
-        let store_ptr = addr_of_mut!(USER_RULE_STORE);
-        match (*store_ptr).as_ref() {
-            Some(store) => match store.get_all_rules() {
-                Ok(rules) => rules, // Borrow the rules list
-                Err(e) => {
-                    pr_err!("Failed to get all rules: {:?}", e);
-                    return -EFAULT.to_errno() as isize;
+    // A read from the start picks up the current version of the store, the following
+    // chunks keep using the same rendering so that the offsets stay consistent.
+    if current_offset == 0 || !state.rendered {
+        // Safely access the global USER_RULE_STORE
+        let rules = unsafe {
+            let store_ptr = addr_of_mut!(USER_RULE_STORE);
+            match (*store_ptr).as_ref() {
+                Some(store) => match store.get_all_rules() {
+                    Ok(rules) => rules, // Shared snapshot, nothing is copied
+                    Err(e) => {
+                        pr_err!("Failed to get all rules: {:?}", e);
+                        return EFAULT.to_errno() as isize;
+                    }
+                },
+                None => {
+                    pr_err!("User rule store is not initialized.");
+                    return EFAULT.to_errno() as isize;
                 }
-            },
-            None => {
-                pr_err!("User rule store is not initialized.");
-                return -EFAULT.to_errno() as isize;
             }
-        }
-    };
+        };
 
-    // Generate the output dynamically using Vec<u8>
-    let mut output : Vec<u8> = Vec::new();
+        if !state.rendered || state.generation != rules.generation() {
+            // Generate the output dynamically using Vec<u8>
+            state.output.clear();
+            state.rendered = false;
 
-    for user_rule in rules {
-        if let Err(e) = pretty_print_rules(user_rule, &mut output){
-            return e.to_errno() as isize;
-        }    
+            let format = state.format;
+            let rendered = if format == READ_FORMAT_BINARY {
+                // The image covers the whole store at once
+                image::render(&rules, &mut state.output)
+            } else {
+                rules.iter().try_for_each(|user_rule| {
+                    if format == READ_FORMAT_TSV {
+                        tsv_print_rules(user_rule, &mut state.output)
+                    } else {
+                        pretty_print_rules(user_rule, &mut state.output)
+                    }
+                })
+            };
+            if let Err(e) = rendered {
+                return e.to_errno() as isize;
+            }
+
+            state.generation = rules.generation();
+            state.rendered = true;
+        }
     }
 
+    let output = &state.output;
+
     // Check if the offset is beyond the buffer
     if current_offset >= output.len() {
         return 0; // EOF
@@ -337,7 +907,7 @@ pub(crate) extern "C" fn rust_read(
             }
             Err(e) => {
                 pr_err!("Failed to write to user buffer: {:?}\n", e);
-                -EFAULT.to_errno() as isize
+                EFAULT.to_errno() as isize
             }
         }
     } else {
@@ -345,7 +915,83 @@ pub(crate) extern "C" fn rust_read(
     }
 }
 
-fn pretty_print_rules(rules: UserRule, output: &mut Vec<u8>)-> Result<(),Error>{
+/// Handles a read of a file in `READ_FORMAT_DELTA`: the changes are rendered only once
+/// the previous ones have been read, then the cursor moves past them.
+/// Returns 0 when there is nothing new.
+fn read_changes(state: &mut FileState, user_buffer: *mut u8, count: usize, offset: *mut u64) -> isize {
+    if state.delta_pos >= state.output.len() {
+        let user_rule_store = match user_rule_store() {
+            Some(store) => store,
+            None => return EFAULT.to_errno() as isize,
+        };
+
+        state.output.clear();
+        state.delta_pos = 0;
+
+        let output = &mut state.output;
+        let cursor = user_rule_store.changes_since(state.cursor, |change| match change {
+            Change::Reset => {
+                output.extend_from_slice(b"*\n", GFP_KERNEL)?;
+                Ok(())
+            }
+            Change::Added(uid, rule) => tsv_push_change(output, b'+', uid, rule.as_bytes()),
+            Change::Removed(uid, rule) => tsv_push_change(output, b'-', uid, rule.as_bytes()),
+        });
+        match cursor {
+            Ok(cursor) => state.cursor = Some(cursor),
+            Err(e) => {
+                // Render the same changes again at the next read
+                state.output.clear();
+                return e.to_errno() as isize;
+            }
+        }
+    }
+
+    let len = core::cmp::min(count, state.output.len() - state.delta_pos);
+    if len == 0 {
+        return 0;
+    }
+
+    let data = &state.output[state.delta_pos..state.delta_pos + len];
+    let mut writer = UserSlice::new(user_buffer as usize, len).writer();
+    if let Err(e) = writer.write_slice(data) {
+        pr_err!("Failed to write to user buffer: {:?}\n", e);
+        return EFAULT.to_errno() as isize;
+    }
+
+    state.delta_pos += len;
+    // SAFETY: the offset comes from the read of the file, see `rust_read`.
+    unsafe { *offset += len as u64 };
+    len as isize
+}
+
+/// Tells poll() whether a read of the file would return something new: a change not
+/// read yet in `READ_FORMAT_DELTA`, otherwise a store different from the last rendering.
+#[no_mangle]
+pub(crate) extern "C" fn rust_poll(file_data: *mut core::ffi::c_void) -> bool {
+    if file_data.is_null() {
+        return false;
+    }
+    let user_rule_store = match user_rule_store() {
+        Some(store) => store,
+        None => return false,
+    };
+
+    // SAFETY: the pointer comes from `rust_open_file` and it lives until the file is released.
+    let state = unsafe { &*(file_data as *const Mutex<FileState>) };
+    let state = state.lock();
+
+    // The deltas come from the working copy, the other formats render the published
+    // version: a change is readable by them once it has been published.
+    if state.format == READ_FORMAT_DELTA {
+        let latest = user_rule_store.latest_generation();
+        state.delta_pos < state.output.len() || state.cursor != Some(latest)
+    } else {
+        !state.rendered || state.generation != user_rule_store.published_generation()
+    }
+}
+
+fn pretty_print_rules(rules: &UserRule, output: &mut Vec<u8>)-> Result<(),Error>{
     // Append the UID line using CString::try_from_fmt
     let uid_str = match CString::try_from_fmt(format_args!("---- UID: {} ----\n", rules.uid)) {
         Ok(cstring) => cstring,
@@ -375,10 +1021,10 @@ fn pretty_print_rules(rules: UserRule, output: &mut Vec<u8>)-> Result<(),Error>{
             return Err(ENOMEM);
         }
 
-        //pr_info!("The rule string is: {}",rule.rule.to_str().expect("Can't display the string"));
+        //pr_info!("The rule string is: {}",rule.as_cstr().to_str().expect("Can't display the string"));
 
         // Append the rule itself
-        if let Err(e) = output.extend_from_slice(rule.rule.as_bytes(), GFP_KERNEL) {
+        if let Err(e) = output.extend_from_slice(rule.as_bytes(), GFP_KERNEL) {
             pr_err!("Failed to append rule string: {:?}\n", e);
             return Err(ENOMEM);
         }
@@ -403,4 +1049,63 @@ fn pretty_print_rules(rules: UserRule, output: &mut Vec<u8>)-> Result<(),Error>{
         return Err(ENOMEM);
     }
     Ok(())
-}
\ No newline at end of file
+}
+
+/// Formats the UID in `digits`, returns the bytes used.
+fn format_uid(uid: u32, digits: &mut [u8; 10]) -> &[u8] {
+    let mut start = digits.len();
+    let mut uid = uid;
+    loop {
+        start -= 1;
+        digits[start] = b'0' + (uid % 10) as u8;
+        uid /= 10;
+        if uid == 0 {
+            break;
+        }
+    }
+    &digits[start..]
+}
+
+/// Appends "<rule>\n"; backslash, tab and newline in the rule are escaped.
+fn tsv_push_rule(output: &mut Vec<u8>, bytes: &[u8]) -> Result<(), Error> {
+    if bytes.iter().any(|&b| b == b'\\' || b == b'\t' || b == b'\n') {
+        for &b in bytes {
+            match b {
+                b'\\' => output.extend_from_slice(b"\\\\", GFP_KERNEL)?,
+                b'\t' => output.extend_from_slice(b"\\t", GFP_KERNEL)?,
+                b'\n' => output.extend_from_slice(b"\\n", GFP_KERNEL)?,
+                _ => output.push(b, GFP_KERNEL)?,
+            }
+        }
+    } else {
+        output.extend_from_slice(bytes, GFP_KERNEL)?;
+    }
+
+    output.push(b'\n', GFP_KERNEL)?;
+    Ok(())
+}
+
+/// Appends one "<uid>\t<rule>\n" line per rule of the user.
+fn tsv_print_rules(rules: &UserRule, output: &mut Vec<u8>) -> Result<(), Error> {
+    // The UID is formatted once and copied in front of every rule
+    let mut digits = [0u8; 10];
+    let uid_str = format_uid(rules.uid, &mut digits);
+
+    for rule in rules.rules.iter() {
+        output.extend_from_slice(uid_str, GFP_KERNEL)?;
+        output.push(b'\t', GFP_KERNEL)?;
+        tsv_push_rule(output, rule.as_bytes())?;
+    }
+
+    Ok(())
+}
+
+/// Appends one "<op><uid>\t<rule>\n" line of `READ_FORMAT_DELTA`.
+fn tsv_push_change(output: &mut Vec<u8>, op: u8, uid: u32, bytes: &[u8]) -> Result<(), Error> {
+    let mut digits = [0u8; 10];
+
+    output.push(op, GFP_KERNEL)?;
+    output.extend_from_slice(format_uid(uid, &mut digits), GFP_KERNEL)?;
+    output.push(b'\t', GFP_KERNEL)?;
+    tsv_push_rule(output, bytes)
+}
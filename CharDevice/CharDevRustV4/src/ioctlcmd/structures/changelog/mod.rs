@@ -0,0 +1,79 @@
+// changelog.rs
+//--------------- CHANGE LOG ---------------
+// This file contains the log of the last changes made to the store, read by the files
+// following the changes (READ_FORMAT_DELTA). Every change has its own generation of the
+// table, a reader only has to remember the last generation it saw: if the log no longer
+// goes back that far the reader starts again from the whole store.
+use kernel::prelude::*;
+
+use crate::ioctlcmd::structures::constant::CHANGE_LOG_SIZE;
+use crate::ioctlcmd::structures::Rule;
+
+/// A rule added to or removed from a user.
+pub(crate) struct ChangeEntry {
+    /// Generation of the table right after the change.
+    pub(crate) generation: u64,
+    pub(crate) uid: u32,
+    pub(crate) added: bool,
+    pub(crate) rule: Rule,
+}
+
+/// Ring of the last `CHANGE_LOG_SIZE` changes, only accessed by the writers under the
+/// lock of the store. It holds a handle to each rule, so removed rules stay readable.
+pub(crate) struct ChangeLog {
+    entries: Vec<ChangeEntry>,
+    /// Position of the oldest entry once the ring is full.
+    head: usize,
+    /// The log has every change made after this generation.
+    start: u64,
+}
+
+impl ChangeLog {
+    pub(crate) const fn new() -> Self {
+        Self {
+            entries: Vec::new(),
+            head: 0,
+            start: 0,
+        }
+    }
+
+    /// Records a change. If it can't be stored the log restarts from it, the readers
+    /// behind it will read the whole store instead.
+    pub(crate) fn record(&mut self, generation: u64, uid: u32, added: bool, rule: Rule) {
+        let entry = ChangeEntry { generation, uid, added, rule };
+
+        if self.entries.len() < CHANGE_LOG_SIZE {
+            if self.entries.capacity() == 0 && self.entries.reserve(CHANGE_LOG_SIZE, GFP_KERNEL).is_err() {
+                self.start = generation;
+                return;
+            }
+            // The capacity has been reserved at once, it never allocates
+            if self.entries.push(entry, GFP_KERNEL).is_err() {
+                self.start = generation;
+            }
+            return;
+        }
+
+        self.start = self.entries[self.head].generation;
+        self.entries[self.head] = entry;
+        self.head = (self.head + 1) % CHANGE_LOG_SIZE;
+    }
+
+    /// Forgets every change up to `generation`, e.g. when the whole store is replaced.
+    pub(crate) fn reset(&mut self, generation: u64) {
+        self.entries.clear();
+        self.head = 0;
+        self.start = generation;
+    }
+
+    /// Iterates in order over the changes made after `generation`,
+    /// `None` if some of them are no longer in the log.
+    pub(crate) fn since(&self, generation: u64) -> Option<impl Iterator<Item = &ChangeEntry>> {
+        if generation < self.start {
+            return None;
+        }
+
+        let (newer, older) = self.entries.split_at(self.head);
+        Some(older.iter().chain(newer.iter()).filter(move |entry| entry.generation > generation))
+    }
+}
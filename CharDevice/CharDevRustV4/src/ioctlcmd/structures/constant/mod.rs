@@ -1,3 +1,8 @@
 pub(crate) const RULE_SIZE: usize = 256; // Max size of each rule string
 pub(crate) const RULE_NUMBER: usize = 16;
 pub(crate) const RULE_BUFFER_SIZE: usize = RULE_SIZE * RULE_NUMBER; // Max size of each rule string
+pub(crate) const UID_INDEX_MIN_CAPACITY: usize = 64; // Initial number of slots of the UID index, power of two
+pub(crate) const RULE_TABLE_MIN_HOLES: usize = 64; // Holes left by removed users before compacting the table
+pub(crate) const IOCTL_BATCH_MAX: usize = 1024; // Max number of rules in a single batched IOCTL
+pub(crate) const RULE_INTERN_MIN_CAPACITY: usize = 64; // Initial number of slots of the rule intern table, power of two
+pub(crate) const CHANGE_LOG_SIZE: usize = 4096; // Changes kept for the files reading the deltas
@@ -0,0 +1,226 @@
+// image.rs
+//--------------- POLICY IMAGE ---------------
+// This file contains the binary format of a whole policy, produced by `sec_tool compile`
+// (libsecrules.c) or by reading the device in the binary format, and loaded at init or
+// with a single ioctl. The store is built straight from it: every distinct rule is
+// copied once, the users only refer to the rules by index.
+//
+// Layout, every integer is a little endian u32:
+//   header:  magic "SECP", version, size of the whole image, strings, users, rules
+//   strings: `strings` times: length, bytes of the rule (no NUL byte)
+//   users:   `users` times: uid, number of rules, index of each rule in the strings
+use kernel::prelude::*;
+
+use crate::ioctlcmd::structures::constant::RULE_SIZE;
+use crate::ioctlcmd::structures::{RuleTable, UserRule, WorkingCopy};
+use kernel::sync::Arc;
+
+pub(crate) const IMAGE_MAGIC: [u8; 4] = *b"SECP";
+pub(crate) const IMAGE_VERSION: u32 = 1;
+const HEADER_SIZE: usize = 24;
+
+/// Sequential reader of an image, so that an image in user memory is never copied whole.
+pub(crate) trait ImageSource {
+    /// Bytes left to read.
+    fn remaining(&self) -> usize;
+    /// Fills `out` with the next bytes, fails with `EINVAL` past the end of the image.
+    fn read(&mut self, out: &mut [u8]) -> Result<(), Error>;
+
+    fn read_u32(&mut self) -> Result<u32, Error> {
+        let mut bytes = [0u8; 4];
+        self.read(&mut bytes)?;
+        Ok(u32::from_le_bytes(bytes))
+    }
+}
+
+/// An image already in kernel memory, e.g. loaded with `request_firmware`.
+impl ImageSource for &[u8] {
+    fn remaining(&self) -> usize {
+        self.len()
+    }
+
+    fn read(&mut self, out: &mut [u8]) -> Result<(), Error> {
+        if out.len() > self.len() {
+            return Err(EINVAL);
+        }
+        let (head, tail) = self.split_at(out.len());
+        out.copy_from_slice(head);
+        *self = tail;
+        Ok(())
+    }
+}
+
+impl WorkingCopy {
+    /// Builds a working copy holding exactly the rules of the image.
+    ///
+    /// The image is untrusted: sizes and indexes are checked against the header, and each
+    /// distinct rule gets the same checks as a rule added through the ioctls, once.
+    pub(super) fn from_image(source: &mut impl ImageSource) -> Result<Self, Error> {
+        let size = source.remaining();
+        let mut magic = [0u8; 4];
+        source.read(&mut magic)?;
+        if magic != IMAGE_MAGIC || source.read_u32()? != IMAGE_VERSION {
+            pr_err!("Not a policy image of version {}\n", IMAGE_VERSION);
+            return Err(EINVAL);
+        }
+        if source.read_u32()? as usize != size {
+            pr_err!("The policy image is truncated\n");
+            return Err(EINVAL);
+        }
+        let strings = source.read_u32()? as usize;
+        let users = source.read_u32()? as usize;
+        let rules = source.read_u32()? as usize;
+
+        // Every string takes at least 4 bytes, every user 8 and every reference 4:
+        // bound the allocations before trusting the counts
+        if strings.saturating_mul(4).saturating_add(users.saturating_mul(8)).saturating_add(rules.saturating_mul(4))
+            > size - HEADER_SIZE
+        {
+            return Err(EINVAL);
+        }
+
+        let mut copy = WorkingCopy::new();
+
+        // The working copy takes one use of a rule per reference, counted while reading the users
+        let mut by_index = Vec::with_capacity(strings, GFP_KERNEL)?;
+        let mut uses = Vec::with_capacity(strings, GFP_KERNEL)?;
+        let mut buffer = [0u8; RULE_SIZE + 1];
+        for _ in 0..strings {
+            let len = source.read_u32()? as usize;
+            if len > RULE_SIZE {
+                return Err(EINVAL);
+            }
+            source.read(&mut buffer[..len])?;
+            if buffer[..len].contains(&0) || core::str::from_utf8(&buffer[..len]).is_err() {
+                pr_err!("Invalid rule in the policy image\n");
+                return Err(EINVAL);
+            }
+            buffer[len] = 0;
+
+            // SAFETY: the bytes end with the only NUL byte, checked above.
+            let rule = unsafe { CStr::from_bytes_with_nul_unchecked(&buffer[..=len]) };
+            by_index.push(copy.strings.intern(rule)?, GFP_KERNEL)?;
+            uses.push(0usize, GFP_KERNEL)?;
+        }
+
+        let mut left = rules;
+        for _ in 0..users {
+            let uid = source.read_u32()?;
+            let count = source.read_u32()? as usize;
+            if count == 0 || count > left || copy.table.get(uid).is_some() {
+                return Err(EINVAL);
+            }
+            left -= count;
+
+            let mut user_rules = Vec::with_capacity(count, GFP_KERNEL)?;
+            for _ in 0..count {
+                let index = source.read_u32()? as usize;
+                let rule = by_index.get(index).ok_or(EINVAL)?;
+                user_rules.push(rule.clone(), GFP_KERNEL)?;
+                uses[index] += 1;
+            }
+
+            copy.table.insert(Arc::new(UserRule::new(uid, user_rules)?, GFP_KERNEL)?)?;
+        }
+
+        if left != 0 || source.remaining() != 0 {
+            return Err(EINVAL);
+        }
+
+        // `intern` took one use per string, replace it with the real ones
+        for (rule, uses) in by_index.iter().zip(uses.iter()) {
+            copy.strings.add_uses(rule, *uses);
+            copy.strings.release(rule, 1);
+        }
+
+        Ok(copy)
+    }
+}
+
+/// Assigns the index of each rule in the image, the rules being interned the same object
+/// is written only once. Open addressing over the address of the object.
+struct StringIds {
+    entries: Vec<(usize, u32)>,
+    next: u32,
+}
+
+impl StringIds {
+    fn new(max: usize) -> Result<Self, Error> {
+        let capacity = (max * 2).next_power_of_two().max(16);
+        let mut entries = Vec::with_capacity(capacity, GFP_KERNEL)?;
+        for _ in 0..capacity {
+            entries.push((0, 0), GFP_KERNEL)?;
+        }
+        Ok(Self { entries, next: 0 })
+    }
+
+    /// Returns the index of the object and true if it is new.
+    fn get_or_insert(&mut self, key: usize) -> (u32, bool) {
+        let mask = self.entries.len() - 1;
+        // Fibonacci hashing, as `hash_64`: the top bits of the product, the low ones
+        // only depend on the low bits of the address
+        let bits = self.entries.len().trailing_zeros();
+        let mut i = ((key as u64).wrapping_mul(0x61C8_8646_80B5_83EB) >> (64 - bits)) as usize;
+        loop {
+            match self.entries[i] {
+                (0, _) => {
+                    let id = self.next;
+                    self.entries[i] = (key, id);
+                    self.next += 1;
+                    return (id, true);
+                }
+                (k, id) if k == key => return (id, false),
+                _ => i = (i + 1) & mask,
+            }
+        }
+    }
+}
+
+fn push_u32(output: &mut Vec<u8>, value: u32) -> Result<(), Error> {
+    output.extend_from_slice(&value.to_le_bytes(), GFP_KERNEL)?;
+    Ok(())
+}
+
+/// Appends the image of the whole table to `output`, in the format read by `from_image`.
+pub(crate) fn render(table: &RuleTable, output: &mut Vec<u8>) -> Result<(), Error> {
+    let rules: usize = table.iter().map(|user_rule| user_rule.rules.len()).sum();
+    if rules > u32::MAX as usize {
+        return Err(E2BIG);
+    }
+
+    let start = output.len();
+    output.extend_from_slice(&[0u8; HEADER_SIZE], GFP_KERNEL)?;
+
+    // Strings first, numbered in order of first use
+    let mut ids = StringIds::new(rules)?;
+    for user_rule in table.iter() {
+        for rule in user_rule.rules.iter() {
+            if ids.get_or_insert(rule.key()).1 {
+                push_u32(output, rule.as_bytes().len() as u32)?;
+                output.extend_from_slice(rule.as_bytes(), GFP_KERNEL)?;
+            }
+        }
+    }
+
+    for user_rule in table.iter() {
+        push_u32(output, user_rule.uid)?;
+        push_u32(output, user_rule.rules.len() as u32)?;
+        for rule in user_rule.rules.iter() {
+            push_u32(output, ids.get_or_insert(rule.key()).0)?;
+        }
+    }
+
+    let size = output.len() - start;
+    if size > u32::MAX as usize {
+        return Err(E2BIG);
+    }
+
+    let header = &mut output[start..start + HEADER_SIZE];
+    header[0..4].copy_from_slice(&IMAGE_MAGIC);
+    header[4..8].copy_from_slice(&IMAGE_VERSION.to_le_bytes());
+    header[8..12].copy_from_slice(&(size as u32).to_le_bytes());
+    header[12..16].copy_from_slice(&ids.next.to_le_bytes());
+    header[16..20].copy_from_slice(&(table.len() as u32).to_le_bytes());
+    header[20..24].copy_from_slice(&(rules as u32).to_le_bytes());
+    Ok(())
+}
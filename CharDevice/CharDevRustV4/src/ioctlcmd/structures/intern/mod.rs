@@ -0,0 +1,167 @@
+// intern.rs
+//--------------- RULE INTERN TABLE ---------------
+// This file contains the table that deduplicates the rule strings.
+// Identical rules added to different users share the same object of the rule cache:
+// users only hold handles to it, and two rules are equal if their handles are.
+use kernel::prelude::*;
+
+use crate::ioctlcmd::structures::constant::RULE_INTERN_MIN_CAPACITY;
+use crate::ioctlcmd::structures::Rule;
+
+struct InternEntry {
+    hash: u32,
+    /// Occurrences of the rule in the working copy of the store.
+    uses: usize,
+    rule: Option<Rule>,
+}
+
+impl InternEntry {
+    const EMPTY: Self = Self { hash: 0, uses: 0, rule: None };
+
+    fn is_empty(&self) -> bool {
+        self.rule.is_none()
+    }
+}
+
+/// FNV-1a hash of the bytes of a rule.
+fn hash_rule(bytes: &[u8]) -> u32 {
+    let mut hash: u32 = 0x811c_9dc5;
+    for &byte in bytes {
+        hash ^= byte as u32;
+        hash = hash.wrapping_mul(0x0100_0193);
+    }
+    hash
+}
+
+/// Maps the bytes of each rule in use to its single shared copy.
+///
+/// Only the writers use it, under the lock of the store: the published versions
+/// of the table keep the rules alive through their own handles. A rule leaves the
+/// table when its last occurrence is removed from the working copy.
+/// Like the UID index, it uses linear probing with backward shift deletion.
+pub(crate) struct InternTable {
+    entries: Vec<InternEntry>,
+    len: usize,
+}
+
+impl InternTable {
+    pub(crate) const fn new() -> Self {
+        Self {
+            entries: Vec::new(),
+            len: 0,
+        }
+    }
+
+    /// Position inside `entries` of the rule with the given bytes, if present.
+    fn find(&self, hash: u32, bytes: &[u8]) -> Option<usize> {
+        if self.entries.is_empty() {
+            return None;
+        }
+
+        let mask = self.entries.len() - 1;
+        let mut i = (hash as usize) & mask;
+        loop {
+            let entry = &self.entries[i];
+            match entry.rule.as_ref() {
+                None => return None,
+                Some(rule) if entry.hash == hash && rule.as_bytes() == bytes => return Some(i),
+                Some(_) => i = (i + 1) & mask,
+            }
+        }
+    }
+
+    /// Returns the shared copy of the given rule, if some user has it.
+    pub(crate) fn get(&self, rule: &CStr) -> Option<&Rule> {
+        self.find(hash_rule(rule.as_bytes()), rule.as_bytes())
+            .and_then(|i| self.entries[i].rule.as_ref())
+    }
+
+    /// Returns the shared copy of the given rule for a new occurrence,
+    /// the rule is copied into the rule cache only the first time.
+    pub(crate) fn intern(&mut self, rule: &CStr) -> Result<Rule, Error> {
+        let hash = hash_rule(rule.as_bytes());
+        if let Some(i) = self.find(hash, rule.as_bytes()) {
+            let entry = &mut self.entries[i];
+            entry.uses += 1;
+            return entry.rule.clone().ok_or(EINVAL);
+        }
+
+        if (self.len + 1) * 4 > self.entries.len() * 3 {
+            self.grow()?;
+        }
+
+        let new_rule = Rule::new(rule)?;
+        self.place(InternEntry { hash, uses: 1, rule: Some(new_rule.clone()) });
+        self.len += 1;
+        Ok(new_rule)
+    }
+
+    /// Records `count` new occurrences of a rule already in the table.
+    pub(crate) fn add_uses(&mut self, rule: &Rule, count: usize) {
+        if let Some(i) = self.find(hash_rule(rule.as_bytes()), rule.as_bytes()) {
+            self.entries[i].uses += count;
+        }
+    }
+
+    /// Records that `count` occurrences of the rule have been removed from the working copy.
+    pub(crate) fn release(&mut self, rule: &Rule, count: usize) {
+        let i = match self.find(hash_rule(rule.as_bytes()), rule.as_bytes()) {
+            Some(i) => i,
+            None => return,
+        };
+
+        let entry = &mut self.entries[i];
+        entry.uses = entry.uses.saturating_sub(count);
+        if entry.uses == 0 {
+            self.remove_at(i);
+        }
+    }
+
+    /// Removes the entry at the given position, using backward shift deletion.
+    fn remove_at(&mut self, mut hole: usize) {
+        let mask = self.entries.len() - 1;
+        let mut i = hole;
+        loop {
+            i = (i + 1) & mask;
+            if self.entries[i].is_empty() {
+                break;
+            }
+            let home = (self.entries[i].hash as usize) & mask;
+            if (i.wrapping_sub(home) & mask) >= (i.wrapping_sub(hole) & mask) {
+                self.entries.swap(hole, i);
+                hole = i;
+            }
+        }
+
+        // Drops the handle of the table, the rule is freed when the last user of it is gone
+        self.entries[hole] = InternEntry::EMPTY;
+        self.len -= 1;
+    }
+
+    /// Stores the entry in the first free position of its probe chain.
+    fn place(&mut self, new_entry: InternEntry) {
+        let mask = self.entries.len() - 1;
+        let mut i = (new_entry.hash as usize) & mask;
+        while !self.entries[i].is_empty() {
+            i = (i + 1) & mask;
+        }
+        self.entries[i] = new_entry;
+    }
+
+    /// Doubles the capacity of the table and rehashes every entry.
+    fn grow(&mut self) -> Result<(), Error> {
+        let capacity = core::cmp::max(RULE_INTERN_MIN_CAPACITY, self.entries.len() * 2);
+
+        let mut entries = Vec::with_capacity(capacity, GFP_KERNEL)?;
+        for _ in 0..capacity {
+            entries.push(InternEntry::EMPTY, GFP_KERNEL)?;
+        }
+
+        let old_entries = core::mem::replace(&mut self.entries, entries);
+        for entry in old_entries.into_iter().filter(|entry| !entry.is_empty()) {
+            self.place(entry);
+        }
+
+        Ok(())
+    }
+}
@@ -0,0 +1,132 @@
+// matcher.rs
+//--------------- PATH MATCHER ---------------
+// This file contains the structure used to evaluate the path rules of a user.
+// The rules starting with '/' are compiled by the writers into a byte trie, so that
+// checking a path costs one walk over its bytes, whatever the number of rules.
+use kernel::prelude::*;
+
+use crate::ioctlcmd::structures::Rule;
+
+const NO_NODE: u32 = u32::MAX;
+
+/// The rule matches only the path ending at this node.
+const MATCH_EXACT: u8 = 1;
+/// The rule matches every path starting with the bytes up to this node.
+const MATCH_PREFIX: u8 = 2;
+
+#[derive(Debug, Clone, Copy)]
+struct TrieNode {
+    byte: u8,
+    matches: u8,
+    first_child: u32,
+    next_sibling: u32,
+}
+
+impl TrieNode {
+    const fn new(byte: u8) -> Self {
+        Self {
+            byte,
+            matches: 0,
+            first_child: NO_NODE,
+            next_sibling: NO_NODE,
+        }
+    }
+}
+
+/// Compiled path rules of a user.
+///
+/// A path rule starts with '/'. If it ends with '/' or '*' it matches every path
+/// starting with it (the '*' is not part of the prefix), otherwise only the same path.
+/// The other rules are not evaluated. A matcher without path rules does not allocate.
+#[derive(Debug)]
+pub(crate) struct PathMatcher {
+    /// Nodes of the trie, the root is the first one.
+    nodes: Vec<TrieNode>,
+}
+
+impl PathMatcher {
+    /// Compiles the path rules among the given ones.
+    pub(crate) fn new(rules: &[Rule]) -> Result<Self, Error> {
+        let mut matcher = Self { nodes: Vec::new() };
+
+        for rule in rules.iter() {
+            let bytes = rule.as_bytes();
+            if bytes.first() != Some(&b'/') {
+                continue;
+            }
+
+            match bytes.split_last() {
+                Some((b'*', prefix)) => matcher.insert(prefix, MATCH_PREFIX)?,
+                Some((b'/', _)) => matcher.insert(bytes, MATCH_PREFIX)?,
+                _ => matcher.insert(bytes, MATCH_EXACT)?,
+            }
+        }
+
+        Ok(matcher)
+    }
+
+    /// Returns true if there are no path rules.
+    pub(crate) fn is_empty(&self) -> bool {
+        self.nodes.is_empty()
+    }
+
+    /// Child of the node with the given byte, if present.
+    fn child(&self, node: usize, byte: u8) -> Option<usize> {
+        let mut child = self.nodes[node].first_child;
+        while child != NO_NODE {
+            let candidate = &self.nodes[child as usize];
+            if candidate.byte == byte {
+                return Some(child as usize);
+            }
+            child = candidate.next_sibling;
+        }
+        None
+    }
+
+    fn insert(&mut self, pattern: &[u8], matches: u8) -> Result<(), Error> {
+        if self.nodes.is_empty() {
+            self.nodes.push(TrieNode::new(0), GFP_KERNEL)?;
+        }
+
+        let mut node = 0;
+        for &byte in pattern {
+            node = match self.child(node, byte) {
+                Some(child) => child,
+                None => {
+                    let child = self.nodes.len();
+                    let mut new_node = TrieNode::new(byte);
+                    new_node.next_sibling = self.nodes[node].first_child;
+                    self.nodes.push(new_node, GFP_KERNEL)?;
+                    self.nodes[node].first_child = child as u32;
+                    child
+                }
+            };
+        }
+
+        self.nodes[node].matches |= matches;
+        Ok(())
+    }
+
+    /// Returns true if a path rule matches the given path.
+    ///
+    /// It never allocates nor sleeps, the cost is bounded by the length of the path
+    /// times the number of distinct bytes following a common prefix.
+    pub(crate) fn matches(&self, path: &[u8]) -> bool {
+        if self.nodes.is_empty() {
+            return false;
+        }
+
+        let mut node = 0;
+        for &byte in path {
+            if self.nodes[node].matches & MATCH_PREFIX != 0 {
+                return true;
+            }
+            node = match self.child(node, byte) {
+                Some(child) => child,
+                None => return false,
+            };
+        }
+
+        self.nodes[node].matches != 0
+    }
+}
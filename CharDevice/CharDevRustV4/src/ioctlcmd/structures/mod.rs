@@ -1,33 +1,122 @@
 // structures.rs
 //--------------- STRUCTURE DEFINITION---------------
 // This file contains the structures used to manage the rules.
-use kernel::{str::CString, fmt};
 use kernel::prelude::*;
-use kernel::sync::{new_mutex, Mutex};
+use kernel::sync::{new_mutex, Arc, Mutex};
+use core::mem::ManuallyDrop;
+use core::ptr::{self, addr_of, addr_of_mut, NonNull};
+use core::sync::atomic::{fence, AtomicBool, AtomicPtr, AtomicU64, AtomicUsize, Ordering};
 
+pub(crate) mod changelog;
 pub(crate) mod constant;
+pub(crate) mod image;
+pub(crate) mod intern;
+pub(crate) mod matcher;
+pub(crate) mod rcu;
+pub(crate) mod rule_cache;
+pub(crate) mod uid_index;
 
-use crate::ioctlcmd::structures::constant::{RULE_SIZE};
+use crate::ioctlcmd::structures::changelog::ChangeLog;
+use crate::ioctlcmd::structures::constant::{RULE_SIZE, RULE_TABLE_MIN_HOLES};
+use crate::ioctlcmd::structures::intern::InternTable;
+use crate::ioctlcmd::structures::matcher::PathMatcher;
+use crate::ioctlcmd::structures::rcu::RcuReadGuard;
+use crate::ioctlcmd::structures::rule_cache::RuleEntry;
+use crate::ioctlcmd::structures::uid_index::UidIndex;
 
-#[derive(Debug)]
+/// A rule, stored in an object of the rule cache.
+///
+/// The rule is a handle: cloning it shares the same object. Rules added through the
+/// store are interned, so two rules with the same bytes are the same object and
+/// comparing them is a pointer compare (see `same`).
 pub(crate) struct Rule {
-    pub(crate) rule: CString,
+    entry: NonNull<RuleEntry>,
 }
 
+// SAFETY: the bytes of the object are never modified after the creation,
+// the reference count is atomic.
+unsafe impl Send for Rule {}
+// SAFETY: see above, shared references only read the bytes.
+unsafe impl Sync for Rule {}
+
 impl Rule {
-    /// Takes in input a Cstring and initialize the new rule
-    pub(crate) fn new(rule_data: CString) -> Result<Self, Error> {
-        if rule_data.as_bytes().len() > RULE_SIZE {
+    /// Takes in input a CStr and copies it into a new object of the rule cache
+    pub(crate) fn new(rule_data: &CStr) -> Result<Self, Error> {
+        let bytes = rule_data.as_bytes_with_nul();
+        if bytes.len() > RULE_SIZE + 1 {
             return Err(EINVAL);
         }
-        Ok(Self { rule: rule_data })
+
+        let entry = rule_cache::alloc()?;
+        // SAFETY: the object has just been allocated and it has room for RULE_SIZE + 1 bytes.
+        // Only the first `len + 1` bytes of `data` are initialized and ever read.
+        unsafe {
+            let ptr = entry.as_ptr();
+            addr_of_mut!((*ptr).refcount).write(AtomicUsize::new(1));
+            addr_of_mut!((*ptr).len).write((bytes.len() - 1) as u32);
+            ptr::copy_nonoverlapping(bytes.as_ptr(), addr_of_mut!((*ptr).data) as *mut u8, bytes.len());
+        }
+
+        Ok(Self { entry })
     }
 
-    /// Custom clone implementation by creating a new CString with the same contents
-    pub(crate) fn clone(&self) -> Result<Self, Error> {
-        Ok(Rule {
-            rule: CString::try_from_fmt(fmt!("{}", self.rule.to_str().expect("UTF8 error during Clone"))).unwrap(),
-        })
+    /// Bytes of the rule, without the NUL byte.
+    pub(crate) fn as_bytes(&self) -> &[u8] {
+        let bytes = self.as_cstr().as_bytes_with_nul();
+        &bytes[..bytes.len() - 1]
+    }
+
+    pub(crate) fn as_cstr(&self) -> &CStr {
+        // SAFETY: the object is initialized by `new` with `len` bytes followed by the NUL byte,
+        // and it lives as long as its handles.
+        unsafe {
+            let ptr = self.entry.as_ptr();
+            let len = (*ptr).len as usize;
+            let bytes = core::slice::from_raw_parts(addr_of!((*ptr).data) as *const u8, len + 1);
+            CStr::from_bytes_with_nul_unchecked(bytes)
+        }
+    }
+
+    /// Returns true if both handles refer to the same object.
+    /// For interned rules it is the same as comparing their bytes.
+    pub(crate) fn same(&self, other: &Rule) -> bool {
+        self.entry == other.entry
+    }
+
+    /// Identity of the object, the same for every handle of the rule.
+    pub(crate) fn key(&self) -> usize {
+        self.entry.as_ptr() as usize
+    }
+
+    fn refcount(&self) -> &AtomicUsize {
+        // SAFETY: the object is alive as long as this handle.
+        unsafe { &(*self.entry.as_ptr()).refcount }
+    }
+}
+
+impl Clone for Rule {
+    /// Shares the rule, used by the writers when a user gets a new set of rules.
+    fn clone(&self) -> Self {
+        self.refcount().fetch_add(1, Ordering::Relaxed);
+        Self { entry: self.entry }
+    }
+}
+
+impl Drop for Rule {
+    fn drop(&mut self) {
+        if self.refcount().fetch_sub(1, Ordering::Release) != 1 {
+            return;
+        }
+        fence(Ordering::Acquire);
+
+        // SAFETY: the object comes from `rule_cache::alloc` and this was its last handle.
+        unsafe { rule_cache::free(self.entry) };
+    }
+}
+
+impl core::fmt::Debug for Rule {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("Rule").field("rule", &self.as_cstr()).finish()
     }
 }
 
@@ -36,117 +125,615 @@ impl Rule {
 pub(crate) struct UserRule {
     pub(crate) uid: u32,
     pub(crate) rules: Vec<Rule>,
+    /// Path rules of the user. The writers only mark it stale, it is compiled again
+    /// once per publication (see `RuleTable::refresh_matchers`).
+    pub(crate) matcher: PathMatcher,
+    /// Generation of the working copy that created this copy of the user: after the
+    /// publication of that generation the user is shared with the readers.
+    created: u64,
+    /// Set when `rules` changed after `matcher` was compiled.
+    stale: bool,
 }
 
 impl UserRule {
-    /// Custom clone implementation by cloning each Rule in the vector
-    fn clone(&self) -> Result<Self, Error> {
-        // Create a new Vec<Rule> with the same capacity as the original
-        let mut cloned_rules = Vec::with_capacity(self.rules.len(), GFP_KERNEL).expect("User Rule clone failed");
+    fn new(uid: u32, rules: Vec<Rule>) -> Result<Self, Error> {
+        let matcher = PathMatcher::new(&rules)?;
+        Ok(Self { uid, rules, matcher, created: 0, stale: false })
+    }
+
+    /// A user of the working copy whose matcher is compiled at the next publication.
+    fn pending(uid: u32, rules: Vec<Rule>, created: u64) -> Result<Self, Error> {
+        Ok(Self { uid, rules, matcher: PathMatcher::new(&[])?, created, stale: true })
+    }
+}
+
+/// One entry of a batched request, the rule is borrowed from the buffer of the request.
+pub(crate) struct BatchEntry<'a> {
+    pub(crate) uid: u32,
+    /// The rule to add or remove, `None` if the entry has already been rejected.
+    pub(crate) rule: Option<&'a CStr>,
+    /// Outcome of the entry: 0 or a negative errno.
+    pub(crate) status: i32,
+}
+
+/// Backing table of the store.
+///
+/// Users are kept in insertion order, so that the `/dev/secrules` output does not
+/// depend on the hashing, and are located through the UID index. Removing a user
+/// leaves a hole in its slot; holes are compacted once they outnumber live users.
+///
+/// Users are shared (`Arc`) between the working copy and the published versions.
+/// A writer copies a published user once, on its first change after a publication;
+/// until the next publication the copy is private to the working copy and the
+/// following changes modify it in place.
+pub(crate) struct RuleTable {
+    users: Vec<Option<Arc<UserRule>>>,
+    index: UidIndex,
+    holes: usize,
+    /// Incremented by every change, it identifies the version of the table.
+    generation: u64,
+    /// Generation of the last publication of the working copy: the users created
+    /// up to it may be referenced by the readers.
+    published: u64,
+}
+
+impl RuleTable {
+    const fn new() -> Self {
+        Self {
+            users: Vec::new(),
+            index: UidIndex::new(),
+            holes: 0,
+            generation: 0,
+            published: 0,
+        }
+    }
 
-        // Manually iterate and clone each rule, pushing it into the new Vec
-        for rule in &self.rules {
-            cloned_rules.push(rule.clone()?, GFP_KERNEL)?;
+    /// Copies the table, the users themselves are shared and not duplicated.
+    fn try_clone(&self) -> Result<Self, Error> {
+        let mut users = Vec::with_capacity(self.users.len(), GFP_KERNEL)?;
+        for user_rule in self.users.iter() {
+            users.push(user_rule.clone(), GFP_KERNEL)?;
         }
 
-        Ok(UserRule {
-            uid: self.uid,
-            rules: cloned_rules,
+        Ok(Self {
+            users,
+            index: self.index.try_clone()?,
+            holes: self.holes,
+            generation: self.generation,
+            published: self.published,
         })
     }
+
+    /// Version of the table, it changes every time a rule is added or removed.
+    pub(crate) fn generation(&self) -> u64 {
+        self.generation
+    }
+
+    /// Number of users stored in the table.
+    pub(crate) fn len(&self) -> usize {
+        self.users.len() - self.holes
+    }
+
+    pub(crate) fn get(&self, uid: u32) -> Option<&UserRule> {
+        self.index.get(uid).and_then(|slot| self.users[slot].as_deref())
+    }
+
+    /// Returns a new reference to the given user, its rules are not copied.
+    pub(crate) fn get_shared(&self, uid: u32) -> Option<Arc<UserRule>> {
+        self.index.get(uid).and_then(|slot| self.users[slot].clone())
+    }
+
+    /// Appends a new user, the caller must ensure that the UID is not already present.
+    fn insert(&mut self, user_rule: Arc<UserRule>) -> Result<(), Error> {
+        let uid = user_rule.uid;
+        let slot = self.users.len();
+
+        self.users.push(Some(user_rule), GFP_KERNEL)?;
+        if let Err(e) = self.index.insert(uid, slot) {
+            self.users.pop();
+            return Err(e);
+        }
+
+        Ok(())
+    }
+
+    /// Removes the user with the given UID, if present.
+    fn remove(&mut self, uid: u32) {
+        if let Some(slot) = self.index.get(uid) {
+            self.users[slot] = None;
+            self.index.remove(uid);
+            self.holes += 1;
+
+            if self.holes >= RULE_TABLE_MIN_HOLES && self.holes * 2 > self.users.len() {
+                self.compact();
+            }
+        }
+    }
+
+    /// Moves the live users to the front, preserving their order.
+    fn compact(&mut self) {
+        let mut next = 0;
+        for slot in 0..self.users.len() {
+            if let Some(uid) = self.users[slot].as_ref().map(|user_rule| user_rule.uid) {
+                self.users.swap(next, slot);
+                self.index.update(uid, next);
+                next += 1;
+            }
+        }
+        self.users.truncate(next);
+        self.holes = 0;
+    }
+
+    /// Returns the private copy of the user in the slot, the slot must hold a user
+    /// created after the last publication.
+    fn private_mut(&mut self, slot: usize) -> Option<&mut UserRule> {
+        let user_rule = self.users[slot].take()?;
+        let ptr = Arc::into_raw(user_rule) as *mut UserRule;
+
+        // SAFETY: `ptr` comes from `Arc::into_raw` and the reference is given back to the slot.
+        self.users[slot] = Some(unsafe { Arc::from_raw(ptr) });
+        // SAFETY: the user has been created after the last publication and `get_shared` is
+        // only used on the published versions, so the slot holds the only reference. The
+        // working copy is only accessed under the lock of the store, which `&mut self` covers.
+        Some(unsafe { &mut *ptr })
+    }
+
+    /// Returns the user in the slot for a change, copying it first if the readers may
+    /// reference it. The copy keeps the changes of the rest of the critical section.
+    fn user_mut(&mut self, slot: usize) -> Result<&mut UserRule, Error> {
+        let current = self.users[slot].as_ref().ok_or(EINVAL)?;
+
+        if current.created <= self.published {
+            // Copy on write: the published versions may still reference the current user
+            let mut rules = Vec::with_capacity(current.rules.len() + 1, GFP_KERNEL)?;
+            for rule in current.rules.iter() {
+                rules.push(rule.clone(), GFP_KERNEL)?;
+            }
+
+            let copy = UserRule::pending(current.uid, rules, self.generation + 1)?;
+            self.users[slot] = Some(Arc::new(copy, GFP_KERNEL)?);
+        }
+
+        self.private_mut(slot).ok_or(EINVAL)
+    }
+
+    /// Adds the rule to the given user, creating the user if needed.
+    fn add_rule(&mut self, uid: u32, new_rule: Rule) -> Result<(), Error> {
+        match self.index.get(uid) {
+            Some(slot) => {
+                let user_rule = self.user_mut(slot)?;
+
+                user_rule.rules.push(new_rule, GFP_KERNEL)?;
+                user_rule.stale = true;
+            }
+            None => {
+                // User does not exist, so create a new UserRule with the provided rule
+                let mut rules = Vec::new();
+                rules.push(new_rule, GFP_KERNEL)?;
+
+                let user_rule = UserRule::pending(uid, rules, self.generation + 1)?;
+                self.insert(Arc::new(user_rule, GFP_KERNEL)?)?;
+            }
+        }
+
+        self.generation += 1;
+        Ok(())
+    }
+
+    /// Removes every occurrence of the rule from the given user.
+    /// Returns the number of occurrences removed, 0 if nothing changed.
+    fn remove_rule(&mut self, uid: u32, rule_to_remove: &Rule) -> Result<usize, Error> {
+        let slot = match self.index.get(uid) {
+            Some(slot) => slot,
+            None => return Ok(0),
+        };
+        let current = match self.users[slot].as_ref() {
+            Some(user_rule) => user_rule,
+            None => return Ok(0),
+        };
+
+        // The rules are interned, no need to compare the bytes
+        let removed = current.rules.iter().filter(|r| r.same(rule_to_remove)).count();
+        if removed == 0 {
+            return Ok(0);
+        }
+
+        // Remove the user if there are no more rules
+        if removed == current.rules.len() {
+            self.remove(uid);
+        } else {
+            let user_rule = self.user_mut(slot)?;
+
+            user_rule.rules.retain(|r| !r.same(rule_to_remove));
+            user_rule.stale = true;
+        }
+
+        self.generation += 1;
+        Ok(removed)
+    }
+
+    /// Compiles the path rules of the users changed since the last publication,
+    /// once for all the changes of each user.
+    fn refresh_matchers(&mut self) -> Result<(), Error> {
+        for slot in 0..self.users.len() {
+            if !matches!(self.users[slot].as_ref(), Some(user_rule) if user_rule.stale) {
+                continue;
+            }
+
+            // Only the private copies of the working copy are ever stale
+            if let Some(user_rule) = self.private_mut(slot) {
+                user_rule.matcher = PathMatcher::new(&user_rule.rules)?;
+                user_rule.stale = false;
+            }
+        }
+        Ok(())
+    }
+
+    /// Iterates over the users in insertion order.
+    pub(crate) fn iter(&self) -> impl Iterator<Item = &UserRule> {
+        self.users.iter().flatten().map(|user_rule| &**user_rule)
+    }
+}
+
+extern "C" {
+    /// Wakes up the files waiting in poll() for a change (c/sec_device.c).
+    fn sec_notify_change();
+}
+
+/// A change reported by `UserRuleStore::changes_since`.
+pub(crate) enum Change<'a> {
+    /// The changes are no longer available: forget every rule, the whole store follows.
+    Reset,
+    Added(u32, &'a Rule),
+    Removed(u32, &'a Rule),
+}
+
+/// Working copy of the store, only accessed by the writers under the lock.
+struct WorkingCopy {
+    table: RuleTable,
+    /// Shared copy of every rule used by `table`.
+    strings: InternTable,
+    /// Last changes of `table`, one per generation.
+    log: ChangeLog,
+}
+
+impl WorkingCopy {
+    const fn new() -> Self {
+        Self {
+            table: RuleTable::new(),
+            strings: InternTable::new(),
+            log: ChangeLog::new(),
+        }
+    }
+
+    fn add_rule(&mut self, uid: u32, new_rule: &CStr) -> Result<(), Error> {
+        let rule = self.strings.intern(new_rule)?;
+
+        if let Err(e) = self.table.add_rule(uid, rule.clone()) {
+            self.strings.release(&rule, 1);
+            return Err(e);
+        }
+        self.log.record(self.table.generation, uid, true, rule);
+        Ok(())
+    }
+
+    fn remove_rule(&mut self, uid: u32, rule_to_remove: &CStr) -> Result<bool, Error> {
+        // A rule that is not interned is not used by any user
+        let rule = match self.strings.get(rule_to_remove) {
+            Some(rule) => rule.clone(),
+            None => return Ok(false),
+        };
+
+        let removed = self.table.remove_rule(uid, &rule)?;
+        if removed > 0 {
+            self.strings.release(&rule, removed);
+            self.log.record(self.table.generation, uid, false, rule);
+        }
+        Ok(removed > 0)
+    }
 }
 
-/// This structure contains all the rules for each user. The access is protected
-/// by a Mutex to avoid concurrency problems.
-#[pin_data]
+/// This structure contains all the rules for each user, indexed by UID.
+///
+/// Writers work on a private copy of the table protected by a Mutex, readers never
+/// take it: they use the last published version of the table, which is replaced
+/// with RCU. Publication happens in a deferred work after every change, readers see a
+/// change once it has run.
+#[pin_data(PinnedDrop)]
 pub struct UserRuleStore {
     #[pin]
-    store: Mutex<Vec<UserRule>>,
+    store: Mutex<WorkingCopy>,
+    /// Version visible to the readers, obtained from `Arc::into_raw`.
+    /// It is replaced only while holding `store`.
+    published: AtomicPtr<RuleTable>,
+    /// Set by the writers when `store` differs from the published version.
+    dirty: AtomicBool,
+    /// Generation of the working copy, read by poll() without the lock.
+    latest: AtomicU64,
 }
 
 impl UserRuleStore {
-    pub(crate) fn new() -> impl PinInit<Self> {
-        pin_init!(Self {
-            store <- new_mutex!(Vec::new()),
+    pub(crate) fn new() -> impl PinInit<Self, Error> {
+        try_pin_init!(Self {
+            store <- new_mutex!(WorkingCopy::new()),
+            published: AtomicPtr::new(Arc::into_raw(Arc::new(RuleTable::new(), GFP_KERNEL)?) as *mut RuleTable),
+            dirty: AtomicBool::new(false),
+            latest: AtomicU64::new(0),
         })
     }
 
+    /// Records that the working copy changed and asks for its publication,
+    /// then wakes up the files waiting for a change.
+    fn changed(&self, store: &WorkingCopy) {
+        self.dirty.store(true, Ordering::Release);
+        rcu::schedule_publish();
+
+        self.latest.store(store.table.generation, Ordering::Release);
+        // SAFETY: FFI call, it only wakes up the wait queue of the device.
+        unsafe { sec_notify_change() };
+    }
+
+    /// Generation of the last change, published or not. It never sleeps.
+    pub(crate) fn latest_generation(&self) -> u64 {
+        self.latest.load(Ordering::Acquire)
+    }
+
+    /// Reports to `report` the changes made after generation `cursor`, in order, and
+    /// returns the generation they lead to. Without a cursor, or if the log does not go
+    /// back to it, a `Reset` is reported, followed by every rule of the store.
+    ///
+    /// It runs under the lock of the store: the writers wait for it.
+    pub(crate) fn changes_since(
+        &self,
+        cursor: Option<u64>,
+        mut report: impl FnMut(Change<'_>) -> Result<(), Error>,
+    ) -> Result<u64, Error> {
+        let store = self.store.lock();
+
+        match cursor.and_then(|cursor| store.log.since(cursor)) {
+            Some(changes) => {
+                for change in changes {
+                    if change.added {
+                        report(Change::Added(change.uid, &change.rule))?;
+                    } else {
+                        report(Change::Removed(change.uid, &change.rule))?;
+                    }
+                }
+            }
+            None => {
+                report(Change::Reset)?;
+                for user_rule in store.table.iter() {
+                    for rule in user_rule.rules.iter() {
+                        report(Change::Added(user_rule.uid, rule))?;
+                    }
+                }
+            }
+        }
+
+        Ok(store.table.generation)
+    }
+
+    /// Publishes the working copy of the table, if it changed since the last publication.
+    pub(crate) fn publish(&self) -> Result<(), Error> {
+        let mut store = self.store.lock();
+
+        if !self.dirty.swap(false, Ordering::AcqRel) {
+            return Ok(());
+        }
+
+        let next = match store.table.refresh_matchers().and_then(|()| store.table.try_clone()) {
+            Ok(table) => Arc::new(table, GFP_KERNEL).map_err(Error::from),
+            Err(e) => Err(e),
+        };
+        let next = match next {
+            Ok(table) => table,
+            Err(e) => {
+                // Keep the changes pending, the next writer will retry.
+                self.dirty.store(true, Ordering::Release);
+                return Err(e);
+            }
+        };
+
+        let old = self.published.swap(Arc::into_raw(next) as *mut RuleTable, Ordering::AcqRel);
+        // Every user of the working copy is now shared with the readers
+        store.table.published = store.table.generation;
+        drop(store);
+
+        // The files rendering the published version have something new to read
+        // SAFETY: FFI call, it only wakes up the wait queue of the device.
+        unsafe { sec_notify_change() };
+
+        // Readers may still be using the old version, release it after a grace period.
+        rcu::release_after_grace_period(old);
+        Ok(())
+    }
+
+    /// Returns a reference to the published version of the table. It never sleeps.
+    ///
+    /// Pending changes are not published here: the writes completed before the call
+    /// are visible once the deferred publication has run.
+    pub(crate) fn snapshot(&self) -> Arc<RuleTable> {
+        let _rcu = RcuReadGuard::new();
+        let table = self.published.load(Ordering::Acquire);
+
+        // SAFETY: `table` comes from `Arc::into_raw` and the reference owned by `published`
+        // is released only after a grace period, so it is still valid inside the critical section.
+        // The reference is borrowed, `ManuallyDrop` avoids giving it back.
+        let table = ManuallyDrop::new(unsafe { Arc::from_raw(table) });
+        Arc::clone(&*table)
+    }
+
     /// Add the given rule associated with a specific user ID.
-    pub(crate) fn add_rule(&self, uid: u32, new_rule: CString) -> Result<(), Error> {
+    /// The rule is copied only if it is not interned yet.
+    pub(crate) fn add_rule(&self, uid: u32, new_rule: &CStr) -> Result<(), Error> {
         let mut store = self.store.lock();
         // pr_info!("The rule string is: {}",new_rule.to_str().expect("Can't display the string"));
 
-        // Find the user with the given UID
-        if let Some(user_rule) = store.iter_mut().find(|ur| ur.uid == uid) {
-            user_rule.rules.push(Rule { rule: new_rule }, GFP_KERNEL)?;
-        } else {
-            // User does not exist, so create a new UserRule with the provided rule
-            let mut rules = Vec::new();
-            rules.push(Rule { rule: new_rule }, GFP_KERNEL)?;
-
-            store.push(UserRule {
-                uid,
-                rules,
-            }, GFP_KERNEL)?;
-        }
+        store.add_rule(uid, new_rule)?;
+        self.changed(&store);
 
         Ok(())
     }
 
     /// Remove the given rule associated with a specific user ID.
-    pub(crate) fn remove_rule(&self, uid: u32, rule_to_remove: CString) -> Result<(), Error> {
+    pub(crate) fn remove_rule(&self, uid: u32, rule_to_remove: &CStr) -> Result<(), Error> {
         let mut store = self.store.lock();
 
-        if let Some(user_rule) = store.iter_mut().find(|ur| ur.uid == uid) {
-            user_rule.rules.retain(|r| r.rule.as_bytes() != rule_to_remove.as_bytes());
+        if store.remove_rule(uid, rule_to_remove)? {
+            self.changed(&store);
+        }
+
+        Ok(())
+    }
+
+    /// Adds all the rules of the batch taking the lock once, the new version is
+    /// published a single time. Returns the number of rules added.
+    pub(crate) fn add_rules(&self, entries: &mut [BatchEntry<'_>]) -> usize {
+        let mut store = self.store.lock();
+        let mut applied = 0;
 
-            // Remove the user if there are no more rules
-            if user_rule.rules.is_empty() {
-                store.retain(|ur| ur.uid != uid);
+        for entry in entries.iter_mut() {
+            if let Some(rule) = entry.rule {
+                match store.add_rule(entry.uid, rule) {
+                    Ok(()) => applied += 1,
+                    Err(e) => entry.status = e.to_errno(),
+                }
             }
         }
 
-        Ok(())
+        if applied > 0 {
+            self.changed(&store);
+        }
+        applied
     }
 
-    /// Retrieves the rules associated with a specific user ID.
-    pub(crate) fn get_rules_by_id(&self, uid: u32) -> Result<Option<UserRule>, Error> {
-        let store = self.store.lock();
+    /// Removes all the rules of the batch taking the lock once, the new version is
+    /// published a single time. Returns the number of entries processed successfully.
+    pub(crate) fn remove_rules(&self, entries: &mut [BatchEntry<'_>]) -> usize {
+        let mut store = self.store.lock();
+        let mut applied = 0;
+        let mut changed = false;
 
-        if let Some(user_rule) = store.iter().find(|user_rule| user_rule.uid == uid) {
-            match user_rule.clone() {
-                    Ok(cloned_rules) => return Ok(Some(cloned_rules)),
-                    Err(e) => {
-                        pr_err!("Failed to clone user rules: {:?}", e);
-                        return Err(e);  // Propagate the error
+        for entry in entries.iter_mut() {
+            if let Some(rule) = entry.rule {
+                match store.remove_rule(entry.uid, rule) {
+                    Ok(removed) => {
+                        changed |= removed;
+                        applied += 1;
                     }
+                    Err(e) => entry.status = e.to_errno(),
+                }
             }
         }
-        else {
-            pr_err!("The specified user doesn't exist");
-            return Err(EINVAL);
+
+        if changed {
+            self.changed(&store);
         }
+        applied
     }
 
-    /// Retrieves all the rules in the store.
-    pub(crate) fn get_all_rules(&self) -> Result<Vec<UserRule>, kernel::error::Error> {
-        let store = self.store.lock();
+    /// Replaces all the rules with the ones of a policy image (see `image`).
+    ///
+    /// The new working copy is built before taking the lock, the writers wait only for the
+    /// swap. On error the current rules are kept. Returns the number of rules loaded.
+    pub(crate) fn load_image(&self, source: &mut impl image::ImageSource) -> Result<usize, Error> {
+        let mut copy = WorkingCopy::from_image(source)?;
+        let rules = copy.table.iter().map(|user_rule| user_rule.rules.len()).sum();
 
-        // Create a new vector to store the cloned UserRules
-        let mut cloned_store = Vec::with_capacity(store.len(), GFP_KERNEL).expect("get_all_rules failed");
+        let mut store = self.store.lock();
+        copy.table.generation = store.table.generation + 1;
+        // The log can't describe the replacement, the readers of the deltas start again
+        copy.log.reset(copy.table.generation);
+        let old = core::mem::replace(&mut *store, copy);
+        self.changed(&store);
+        drop(store);
 
-        for user_rule in store.iter() {
-            match user_rule.clone() {
-                Ok(cloned_user_rule) => cloned_store.push(cloned_user_rule, GFP_KERNEL),
-                Err(e) => {
-                    pr_err!("Failed to clone user rule: {:?}", e);
-                    return Err(e);  // Propagate the error
-                }
-            }?
+        // The published versions keep their own references to the old rules
+        drop(old);
+        Ok(rules)
+    }
+
+    /// Checks the path against the path rules of the user.
+    ///
+    /// Used by the hooks of the other modules: it never sleeps and never takes a reference,
+    /// the published version is only read inside an RCU read-side critical section.
+    /// Pending changes are not published here, they become visible once the deferred
+    /// publication has run.
+    pub(crate) fn check(&self, uid: u32, path: &[u8]) -> bool {
+        let _rcu = RcuReadGuard::new();
+        let table = self.published.load(Ordering::Acquire);
+
+        // SAFETY: `table` comes from `Arc::into_raw` and it is released only after a grace
+        // period, the reference does not outlive the critical section.
+        let table = unsafe { &*table };
+        match table.get(uid) {
+            Some(user_rule) => user_rule.matcher.matches(path),
+            None => false,
+        }
+    }
+
+    /// Generation of the published version, the one used by `check`. It never sleeps.
+    pub(crate) fn published_generation(&self) -> u64 {
+        let _rcu = RcuReadGuard::new();
+        let table = self.published.load(Ordering::Acquire);
+
+        // SAFETY: see `check`.
+        unsafe { &*table }.generation()
+    }
+
+    /// Returns true if the user has path rules, with the same rules as `check`.
+    pub(crate) fn has_path_rules(&self, uid: u32) -> bool {
+        let _rcu = RcuReadGuard::new();
+        let table = self.published.load(Ordering::Acquire);
+
+        // SAFETY: see `check`.
+        let table = unsafe { &*table };
+        match table.get(uid) {
+            Some(user_rule) => !user_rule.matcher.is_empty(),
+            None => false,
         }
+    }
+
+    /// Retrieves the rules associated with a specific user ID.
+    ///
+    /// The returned `UserRule` is shared with the store: it is immutable and it stays
+    /// valid even if the user is changed or removed in the meantime.
+    pub(crate) fn get_rules_by_id(&self, uid: u32) -> Result<Option<Arc<UserRule>>, Error> {
+        let store = self.snapshot();
+
+        match store.get_shared(uid) {
+            Some(user_rule) => Ok(Some(user_rule)),
+            None => {
+                pr_err!("The specified user doesn't exist");
+                Err(EINVAL)
+            }
+        }
+    }
 
-        Ok(cloned_store)
+    /// Retrieves all the rules in the store.
+    ///
+    /// The returned table is an immutable snapshot: iterating over it does not copy
+    /// any rule and does not block the writers.
+    pub(crate) fn get_all_rules(&self) -> Result<Arc<RuleTable>, Error> {
+        Ok(self.snapshot())
     }
 }
 
+#[pinned_drop]
+impl PinnedDrop for UserRuleStore {
+    fn drop(self: Pin<&mut Self>) {
+        // The readers are gone and the pending releases have been flushed (see `sec_rcu_cleanup`).
+        let table = self.published.load(Ordering::Acquire);
+
+        // SAFETY: `table` comes from `Arc::into_raw`, this is the reference owned by `published`.
+        drop(unsafe { Arc::from_raw(table) });
+    }
+}
 
+/// Called by RCU once the readers of a replaced table are gone.
+#[no_mangle]
+pub(crate) extern "C" fn rust_release_table(table: *const core::ffi::c_void) {
+    // SAFETY: the pointer has been handed over by `UserRuleStore::publish`, it comes from
+    // `Arc::into_raw` and it is no longer reachable by the readers.
+    drop(unsafe { Arc::from_raw(table as *const RuleTable) });
+}
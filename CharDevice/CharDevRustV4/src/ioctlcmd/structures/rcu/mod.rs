@@ -0,0 +1,48 @@
+// rcu.rs
+//--------------- RCU HELPERS ---------------
+// This file contains the minimal RCU support needed by the rule store.
+// The primitives are not exposed by the Rust abstractions yet, so they are provided by c/sec_rcu.c.
+use core::marker::PhantomData;
+
+extern "C" {
+    fn sec_rcu_read_lock();
+    fn sec_rcu_read_unlock();
+    fn sec_rcu_release_table(table: *const core::ffi::c_void);
+    fn sec_schedule_publish();
+}
+
+/// RCU read-side critical section, it ends when the guard is dropped.
+///
+/// The code running while the guard is alive must not sleep.
+pub(crate) struct RcuReadGuard {
+    // The critical section is bound to the current CPU/task, the guard can't be sent.
+    _not_send: PhantomData<*mut ()>,
+}
+
+impl RcuReadGuard {
+    pub(crate) fn new() -> Self {
+        // SAFETY: FFI call, the matching unlock is done by `drop`.
+        unsafe { sec_rcu_read_lock() };
+        Self { _not_send: PhantomData }
+    }
+}
+
+impl Drop for RcuReadGuard {
+    fn drop(&mut self) {
+        // SAFETY: FFI call, the lock has been taken by `new`.
+        unsafe { sec_rcu_read_unlock() };
+    }
+}
+
+/// Hands a replaced table over to RCU, `rust_release_table` will be called
+/// with the same pointer once all the pre-existing readers are gone.
+pub(crate) fn release_after_grace_period<T>(table: *const T) {
+    // SAFETY: FFI call, the pointer is only given back to `rust_release_table`.
+    unsafe { sec_rcu_release_table(table as *const core::ffi::c_void) };
+}
+
+/// Asks for the pending changes to be published by the deferred work.
+pub(crate) fn schedule_publish() {
+    // SAFETY: FFI call, it only queues a work item.
+    unsafe { sec_schedule_publish() };
+}
@@ -0,0 +1,59 @@
+// rule_cache.rs
+//--------------- RULE CACHE ---------------
+// This file contains the storage of the rules. Every rule lives in a fixed size object
+// of a dedicated kmem_cache, instead of a CString allocated from the generic kmalloc caches.
+// The cache is not exposed by the Rust abstractions yet, so it is provided by c/sec_rule_cache.c.
+use core::ptr::NonNull;
+use core::sync::atomic::AtomicUsize;
+use kernel::prelude::*;
+
+use crate::ioctlcmd::structures::constant::RULE_SIZE;
+
+extern "C" {
+    fn sec_rule_cache_init(object_size: usize) -> i32;
+    fn sec_rule_cache_destroy();
+    fn sec_rule_alloc() -> *mut core::ffi::c_void;
+    fn sec_rule_free(entry: *mut core::ffi::c_void);
+}
+
+/// Object of the cache: the rule is stored inline, followed by its NUL byte.
+/// The object is shared by all the handles of the same rule, the last one frees it.
+#[repr(C)]
+pub(crate) struct RuleEntry {
+    pub(crate) refcount: AtomicUsize,
+    pub(crate) len: u32,
+    pub(crate) data: [u8; RULE_SIZE + 1],
+}
+
+/// Creates the cache, it must be called before any rule is created.
+pub(crate) fn init() -> Result<(), Error> {
+    // SAFETY: FFI call, it only creates the cache.
+    let ret = unsafe { sec_rule_cache_init(core::mem::size_of::<RuleEntry>()) };
+    if ret < 0 {
+        return Err(Error::from_errno(ret));
+    }
+    Ok(())
+}
+
+/// Destroys the cache, releasing all its slabs at once.
+/// Every rule must have been dropped before.
+pub(crate) fn destroy() {
+    // SAFETY: FFI call, no object of the cache is alive anymore.
+    unsafe { sec_rule_cache_destroy() };
+}
+
+/// Allocates an uninitialized object from the cache.
+pub(crate) fn alloc() -> Result<NonNull<RuleEntry>, Error> {
+    // SAFETY: FFI call, the object is given back to the cache by `free`.
+    NonNull::new(unsafe { sec_rule_alloc() } as *mut RuleEntry).ok_or(ENOMEM)
+}
+
+/// Gives the object back to the cache.
+///
+/// # Safety
+///
+/// `entry` must come from `alloc` and it must not be used anymore.
+pub(crate) unsafe fn free(entry: NonNull<RuleEntry>) {
+    // SAFETY: FFI call, the object comes from `sec_rule_alloc` as required to the caller.
+    unsafe { sec_rule_free(entry.as_ptr() as *mut core::ffi::c_void) };
+}
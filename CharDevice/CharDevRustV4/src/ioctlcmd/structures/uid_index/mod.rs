@@ -0,0 +1,164 @@
+// uid_index.rs
+//--------------- UID INDEX ---------------
+// This file contains the hash index used to locate a user inside the rule store.
+// It is an open addressing table (linear probing) that maps a user ID to the
+// slot holding its rules, so that every lookup is O(1) on average.
+use kernel::prelude::*;
+
+use crate::ioctlcmd::structures::constant::UID_INDEX_MIN_CAPACITY;
+use crate::uid_hash::hash_uid;
+
+/// Marker used for the free entries of the table.
+const EMPTY_SLOT: u32 = u32::MAX;
+
+#[derive(Clone, Copy)]
+struct IndexEntry {
+    uid: u32,
+    slot: u32,
+}
+
+impl IndexEntry {
+    const EMPTY: Self = Self { uid: 0, slot: EMPTY_SLOT };
+
+    fn is_empty(&self) -> bool {
+        self.slot == EMPTY_SLOT
+    }
+}
+
+/// Maps each user ID to the position of its `UserRule` inside the store.
+///
+/// The capacity is always a power of two and the table grows when it is
+/// three quarters full; removals use backward shift deletion, so no
+/// tombstone is ever left behind and lookups never degrade.
+pub(crate) struct UidIndex {
+    entries: Vec<IndexEntry>,
+    len: usize,
+}
+
+impl UidIndex {
+    pub(crate) const fn new() -> Self {
+        Self {
+            entries: Vec::new(),
+            len: 0,
+        }
+    }
+
+    /// Copies the index, used when a new version of the store is built.
+    pub(crate) fn try_clone(&self) -> Result<Self, Error> {
+        let mut entries = Vec::with_capacity(self.entries.len(), GFP_KERNEL)?;
+        entries.extend_from_slice(&self.entries, GFP_KERNEL)?;
+
+        Ok(Self {
+            entries,
+            len: self.len,
+        })
+    }
+
+    /// Home bucket of the given user ID.
+    fn bucket(&self, uid: u32) -> usize {
+        hash_uid(uid, self.entries.len())
+    }
+
+    /// Position inside `entries` of the given user ID, if present.
+    fn find(&self, uid: u32) -> Option<usize> {
+        if self.entries.is_empty() {
+            return None;
+        }
+
+        let mask = self.entries.len() - 1;
+        let mut i = self.bucket(uid);
+        loop {
+            let entry = &self.entries[i];
+            if entry.is_empty() {
+                return None;
+            }
+            if entry.uid == uid {
+                return Some(i);
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    /// Returns the slot associated with the given user ID.
+    pub(crate) fn get(&self, uid: u32) -> Option<usize> {
+        self.find(uid).map(|i| self.entries[i].slot as usize)
+    }
+
+    /// Associates the user ID with the given slot, growing the table if needed.
+    pub(crate) fn insert(&mut self, uid: u32, slot: usize) -> Result<(), Error> {
+        if let Some(i) = self.find(uid) {
+            self.entries[i].slot = slot as u32;
+            return Ok(());
+        }
+
+        if (self.len + 1) * 4 > self.entries.len() * 3 {
+            self.grow()?;
+        }
+
+        self.place(IndexEntry { uid, slot: slot as u32 });
+        self.len += 1;
+        Ok(())
+    }
+
+    /// Moves an already indexed user to another slot. It never allocates.
+    pub(crate) fn update(&mut self, uid: u32, slot: usize) {
+        if let Some(i) = self.find(uid) {
+            self.entries[i].slot = slot as u32;
+        }
+    }
+
+    /// Removes the given user ID from the index.
+    pub(crate) fn remove(&mut self, uid: u32) {
+        let mut hole = match self.find(uid) {
+            Some(i) => i,
+            None => return,
+        };
+
+        // Backward shift deletion: pull back every entry of the probe chain
+        // whose home bucket does not lie between the hole and its position.
+        let mask = self.entries.len() - 1;
+        let mut i = hole;
+        loop {
+            i = (i + 1) & mask;
+            let entry = self.entries[i];
+            if entry.is_empty() {
+                break;
+            }
+            let home = self.bucket(entry.uid);
+            if (i.wrapping_sub(home) & mask) >= (i.wrapping_sub(hole) & mask) {
+                self.entries[hole] = entry;
+                hole = i;
+            }
+        }
+
+        self.entries[hole] = IndexEntry::EMPTY;
+        self.len -= 1;
+    }
+
+    /// Stores the entry in the first free position of its probe chain.
+    fn place(&mut self, new_entry: IndexEntry) {
+        let mask = self.entries.len() - 1;
+        let mut i = self.bucket(new_entry.uid);
+        while !self.entries[i].is_empty() {
+            i = (i + 1) & mask;
+        }
+        self.entries[i] = new_entry;
+    }
+
+    /// Doubles the capacity of the table and rehashes every entry.
+    fn grow(&mut self) -> Result<(), Error> {
+        let capacity = core::cmp::max(UID_INDEX_MIN_CAPACITY, self.entries.len() * 2);
+
+        let mut entries = Vec::with_capacity(capacity, GFP_KERNEL)?;
+        for _ in 0..capacity {
+            entries.push(IndexEntry::EMPTY, GFP_KERNEL)?;
+        }
+
+        let old_entries = core::mem::replace(&mut self.entries, entries);
+        for entry in old_entries.iter().filter(|entry| !entry.is_empty()) {
+            self.place(*entry);
+        }
+
+        Ok(())
+    }
+}
@@ -8,6 +8,7 @@
 //! - Add security rules for specific user IDs.
 //! - Remove existing rules for specific user IDs.
 //! - Retrieve all rules or rules for a specific user ID.
+//! - Load a whole policy image at init (`policy` parameter) or with a single IOCTL.
 //!
 //! # Usage
 //! To check the how to use the module, check the man in sec_tool 
@@ -17,9 +18,12 @@ use kernel::prelude::*;
 use kernel::{str::CString, fmt};
 use core::ptr::{addr_of_mut};
 mod ioctlcmd;
+#[path = "../../../common/uid_hash.rs"]
+mod uid_hash;
 
 use crate::ioctlcmd::{rust_ioctl, rust_read};
 use crate::ioctlcmd::structures::{UserRuleStore,Rule};
+use crate::ioctlcmd::structures::rule_cache;
 
 module! {
     type: SecModule,
@@ -32,6 +36,12 @@ module! {
 extern "C" {
     fn create_device() -> i32;
     fn remove_device();
+    fn sec_rcu_cleanup();
+    fn sec_stats_init();
+    fn sec_stats_cleanup();
+    fn sec_policy_register();
+    fn sec_policy_unregister();
+    fn sec_firmware_load() -> i32;
 }
 
 
@@ -42,6 +52,12 @@ struct SecModule;
 
 impl kernel::Module for SecModule {
     fn init(_module: &'static ThisModule) -> Result<Self> {
+        // The rules are allocated from their own cache, it must exist before the store
+        if let Err(e) = rule_cache::init() {
+            pr_err!("Failed to create the rule cache: {:?}\n", e);
+            return Err(e);
+        }
+
         // Initialize the rule store
         unsafe {
             // Use of mutable static in unsafe, the initialization is done by one single thread. 
@@ -50,16 +66,39 @@ impl kernel::Module for SecModule {
                 Ok(store) => Some(store),
                 Err(e) => {
                     pr_err!("Failed to initialize USER_RULE_STORE: {:?}\n", e);
+                    rule_cache::destroy();
                     return Err(e);
                 }
             };
 
             if create_device() < 0 {
+                USER_RULE_STORE = None;
+                rule_cache::destroy();
                 return Err(EINVAL);
             }
 
+            sec_stats_init();
+
+        }
+
+        // Start from the policy image given as parameter, if any, otherwise from the default rule
+        match unsafe { sec_firmware_load() } {
+            0 => init_rules(),
+            ret if ret < 0 => {
+                unsafe {
+                    remove_device();
+                    sec_stats_cleanup();
+                    sec_rcu_cleanup();
+                    USER_RULE_STORE = None;
+                }
+                rule_cache::destroy();
+                return Err(Error::from_errno(ret));
+            }
+            _ => {}
         }
-        init_rules();
+
+        // The store is ready, hand the policy to the enforcement modules
+        unsafe { sec_policy_register() };
         pr_info!("SecModule initialized\n");
         Ok(SecModule)
     }
@@ -68,13 +107,111 @@ impl kernel::Module for SecModule {
 impl Drop for SecModule {
     fn drop(&mut self) {
         unsafe {
+            // The enforcement modules stop using the policy before the store goes away
+            sec_policy_unregister();
             remove_device();
+            sec_stats_cleanup();
+            // Wait for the pending publication and for the old versions waiting for RCU,
+            // then release the store: nobody can reach it anymore.
+            sec_rcu_cleanup();
+            USER_RULE_STORE = None;
         }
+        // Every rule has been released with the store, the cache can go away
+        rule_cache::destroy();
         pr_info!("Security module unloaded\n");
     }
 }
 
 
+/// Deferred work scheduled by the writers, publishes the pending changes to the readers.
+#[no_mangle]
+pub extern "C" fn rust_publish_rules() {
+    let user_rule_store = unsafe {
+        let store_ptr = addr_of_mut!(USER_RULE_STORE);
+        match (*store_ptr).as_ref() {
+            Some(store) => store,
+            None => return,
+        }
+    };
+
+    if let Err(e) = user_rule_store.publish() {
+        pr_err!("Failed to publish the rules: {:?}\n", e);
+    }
+}
+
+/// Loads the policy image found by `sec_firmware_load` (c/sec_firmware.c), replacing all the rules.
+/// Returns the number of rules loaded or a negative errno.
+#[no_mangle]
+pub extern "C" fn rust_load_policy(image: *const u8, size: usize) -> i32 {
+    let user_rule_store = unsafe {
+        let store_ptr = addr_of_mut!(USER_RULE_STORE);
+        match (*store_ptr).as_ref() {
+            Some(store) => store,
+            None => return EINVAL.to_errno(),
+        }
+    };
+
+    // SAFETY: the firmware data is valid for `size` bytes until it is released, after the call.
+    let mut source = unsafe { core::slice::from_raw_parts(image, size) };
+
+    match user_rule_store.load_image(&mut source) {
+        Ok(rules) => core::cmp::min(rules, i32::MAX as usize) as i32,
+        Err(e) => {
+            pr_err!("Failed to load the policy image: {:?}\n", e);
+            e.to_errno()
+        }
+    }
+}
+
+/// Backend of `sec_rules_check` (c/sec_rules.c), called by the hooks of the other modules.
+/// Returns -EACCES if a path rule of the user matches the path, 0 otherwise. It never sleeps.
+#[no_mangle]
+pub extern "C" fn rust_rules_check(uid: u32, path: *const u8, len: usize) -> i32 {
+    let user_rule_store = unsafe {
+        let store_ptr = addr_of_mut!(USER_RULE_STORE);
+        match (*store_ptr).as_ref() {
+            Some(store) => store,
+            None => return 0,
+        }
+    };
+
+    // SAFETY: the C wrapper passes a valid string of `len` bytes, alive for the whole call.
+    let path = unsafe { core::slice::from_raw_parts(path, len) };
+
+    if user_rule_store.check(uid, path) {
+        EACCES.to_errno()
+    } else {
+        0
+    }
+}
+
+/// Backend of the `has_rules` policy operation (c/sec_rules.c). It never sleeps.
+#[no_mangle]
+pub extern "C" fn rust_rules_has_user(uid: u32) -> bool {
+    let user_rule_store = unsafe {
+        let store_ptr = addr_of_mut!(USER_RULE_STORE);
+        match (*store_ptr).as_ref() {
+            Some(store) => store,
+            None => return false,
+        }
+    };
+
+    user_rule_store.has_path_rules(uid)
+}
+
+/// Backend of the `generation` policy operation (c/sec_rules.c). It never sleeps.
+#[no_mangle]
+pub extern "C" fn rust_rules_generation() -> u64 {
+    let user_rule_store = unsafe {
+        let store_ptr = addr_of_mut!(USER_RULE_STORE);
+        match (*store_ptr).as_ref() {
+            Some(store) => store,
+            None => return 0,
+        }
+    };
+
+    user_rule_store.published_generation()
+}
 
 fn init_rules() {
     let initial_uid: u32 = 1001;
@@ -82,7 +219,7 @@ fn init_rules() {
     // Create an initial CString rule
     let string = CString::try_from_fmt(fmt!("{}","Hello Rust :)")).expect("CString creation failed");
 
-    let initial_rule = Rule::new(string).expect("Problem with rule creation");
+    let initial_rule = Rule::new(&string).expect("Problem with rule creation");
 
     // Safely access the USER_RULE_STORE
     let user_rule_store = unsafe {
@@ -96,7 +233,7 @@ fn init_rules() {
         }
     };
 
-    if let Err(e) = user_rule_store.add_rule(initial_uid, initial_rule.clone().expect("Problem with rule cloning").rule) {
+    if let Err(e) = user_rule_store.add_rule(initial_uid, &string) {
         pr_err!("Failed to add initial rule: {:?}\n", e);
         return;
     }
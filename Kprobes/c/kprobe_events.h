@@ -0,0 +1,22 @@
+// kprobe_events.h
+// Format of the events read from /dev/rust_kprobes_events, shared with user space.
+
+#ifndef KPROBE_EVENTS_H
+#define KPROBE_EVENTS_H
+
+#include <linux/types.h>
+
+#define KPROBE_EVENT_NAME_LEN 36
+
+// One vfs_open of a blacklisted user, 64 bytes.
+// A read returns only whole events, up to the size of the buffer.
+struct kprobe_event {
+    __u64 timestamp_ns;                 // CLOCK_MONOTONIC
+    __u64 inode;
+    __u32 uid;
+    __u32 cpu;
+    __u32 dropped;                      // Events lost on this CPU right before this one (ring full)
+    char name[KPROBE_EVENT_NAME_LEN];   // Name of the dentry, truncated and NUL-terminated
+};
+
+#endif
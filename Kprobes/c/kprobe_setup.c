@@ -3,63 +3,353 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/kprobes.h>
+#include <linux/math64.h>
 #include <linux/cred.h> // For current_cred()
+#include <linux/fprobe.h>
+#include <linux/hash.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
+
+#include "kprobe_events.h"
+#include "hook_stats.h"
+
+// Events kept by each CPU until they are read, power of two
+#define KPROBE_RING_SIZE 1024
+#define KPROBE_RING_MASK (KPROBE_RING_SIZE - 1)
+
+// Decisions cached by each CPU: 8 entries of 8 bytes, one cache line
+#define DECISION_CACHE_BITS 3
+#define DECISION_CACHE_SIZE (1 << DECISION_CACHE_BITS)
 
 int initialize_kprobe(void);
 void cleanup_kprobe(void);
+int kprobe_stats_show(struct seq_file *m, void *v);
+void kprobe_policy_changed(void);
 
 extern bool check_user_id(u32 user_id);  // Rust function to check if UID is blacklisted
 
-static struct kprobe kp = {
-    .symbol_name = "vfs_open",  // Example: Intercept the 'vfs_open' syscall
+// Debug mode: log every blacklisted open with printk, besides recording the event
+static bool debug;
+module_param(debug, bool, 0644);
+MODULE_PARM_DESC(debug, "Log the blacklisted opens to the kernel log (default: false)");
+
+// Attach backend, chosen at load time to compare the cost of the two
+static char *backend = "kprobe";
+module_param(backend, charp, 0444);
+MODULE_PARM_DESC(backend, "Attach backend: kprobe (int3 breakpoint, default) or fprobe (ftrace)");
+
+// Functions intercepted, their first argument is the struct path being accessed
+static const char *probe_symbols[] = {
+    "vfs_open",
+    "vfs_truncate",
 };
 
-// Adjusted function signature to match kprobe_pre_handler_t
-static int handler_pre(struct kprobe *p, struct pt_regs *regs) {
+#define PROBE_SYMBOLS ARRAY_SIZE(probe_symbols)
+
+// Single producer ring: only the owning CPU writes events, with preemption disabled
+// by the kprobe or fprobe. The reader consumes them under events_lock. No lock on the hot path.
+struct kprobe_ring {
+    unsigned int head;      // Next event to write, owned by the producer
+    unsigned int tail;      // Next event to read, owned by the reader
+    unsigned int dropped;   // Events lost since the last recorded one
+    struct kprobe_event events[KPROBE_RING_SIZE];
+};
+
+static DEFINE_PER_CPU(struct kprobe_ring *, kprobe_rings);
+static DEFINE_MUTEX(events_lock);
+
+// Generation of the blacklist, incremented by the Rust side after every update.
+// It starts from 1, so the empty entries of the caches never match.
+static unsigned long policy_generation = 1;
+
+// Recent decisions of check_user_id, so that a process opening many files does not
+// cross the C/Rust boundary every time. An entry packs the low bits of the generation
+// it was computed with, the decision and the UID; an update of the blacklist changes
+// the generation and invalidates all the entries at once.
+struct decision_cache {
+    u64 entries[DECISION_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU_ALIGNED(struct decision_cache, decision_caches);
+
+struct decision_cache_stats {
+    u64 hits;
+    u64 misses;
+};
+
+static DEFINE_PER_CPU(struct decision_cache_stats, decision_stats);
+
+static __always_inline u64 decision_entry(u32 user_id, bool is_blacklisted, unsigned long generation) {
+    return ((u64)(generation & 0x7fffffff) << 33) | ((u64)is_blacklisted << 32) | user_id;
+}
+
+// Called with preemption disabled by the kprobe or fprobe
+static bool cached_check_user_id(u32 user_id) {
+    struct decision_cache *cache = this_cpu_ptr(&decision_caches);
+    unsigned long generation = smp_load_acquire(&policy_generation);
+    u32 slot = hash_32(user_id, DECISION_CACHE_BITS);
+    u64 entry = cache->entries[slot];
+    bool is_blacklisted;
+
+    if (entry == decision_entry(user_id, false, generation)) {
+        this_cpu_inc(decision_stats.hits);
+        return false;
+    }
+    if (entry == decision_entry(user_id, true, generation)) {
+        this_cpu_inc(decision_stats.hits);
+        return true;
+    }
+
+    // The generation has been read first: if the blacklist changes meanwhile,
+    // the new entry is already stale and it will not be used.
+    is_blacklisted = check_user_id(user_id);
+    cache->entries[slot] = decision_entry(user_id, is_blacklisted, generation);
+    this_cpu_inc(decision_stats.misses);
+    return is_blacklisted;
+}
+
+// Called by the Rust side once the new blacklist is visible, the updates are serialized
+void kprobe_policy_changed(void) {
+    smp_store_release(&policy_generation, policy_generation + 1);
+}
+
+// Cost of the handler
+static DEFINE_PER_CPU(struct hook_stats, handler_stats);
+
+// Shown in debugfs by uid_blacklist.c, next to the blacklist
+int kprobe_stats_show(struct seq_file *m, void *v) {
+    u64 hits = 0, misses = 0;
+    int cpu;
+
+    hook_stats_print(m, "handler_pre", &handler_stats);
+
+    for_each_possible_cpu(cpu) {
+        hits += per_cpu(decision_stats, cpu).hits;
+        misses += per_cpu(decision_stats, cpu).misses;
+    }
+    seq_printf(m, "decision_cache: hits %llu misses %llu\n", hits, misses);
+    return 0;
+}
+
+// One kprobe for every symbol, used by the kprobe backend
+static struct kprobe kps[PROBE_SYMBOLS];
+static struct kprobe *kp_list[PROBE_SYMBOLS];
+
+// A single fprobe on all the symbols, used by the fprobe backend
+static struct fprobe fp;
+static bool use_fprobe;
+
+static void record_event(u32 user_id, struct dentry *dentry, struct inode *inode) {
+    struct kprobe_ring *ring = this_cpu_read(kprobe_rings);
+    unsigned int head = ring->head;
+    struct kprobe_event *event;
+
+    if (head - smp_load_acquire(&ring->tail) >= KPROBE_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+
+    event = &ring->events[head & KPROBE_RING_MASK];
+    event->timestamp_ns = ktime_get_mono_fast_ns();
+    event->inode = inode ? inode->i_ino : 0;
+    event->uid = user_id;
+    event->cpu = smp_processor_id();
+    event->dropped = ring->dropped;
+    strscpy(event->name, dentry->d_name.name, sizeof(event->name));
+    ring->dropped = 0;
+
+    // Publish the event to the reader
+    smp_store_release(&ring->head, head + 1);
+}
+
+// Common part of the backends, called with preemption disabled
+static void handle_path_access(const struct path *path) {
     bool is_blacklisted;
-    struct path* path;
     const char *pathname;
     struct inode* inode;
     u32 user_id;
+    u64 start_ns = ktime_get_ns();
 
-    path = (struct path *) regs->di;
     pathname = path->dentry->d_name.name;
     inode = path->dentry->d_inode;
 
     
     // Get the current task's credentials
     const struct cred *cred = current_cred();
-    user_id = from_kuid(&init_user_ns, cred->uid); // Convert UID to a numeric value
+    user_id = __kuid_val(cred->uid); // The global value, the same as from_kuid(&init_user_ns, ...)
 
 
-    // Call the Rust function to handle UID checking
-    is_blacklisted = check_user_id(user_id);
+    // Call the Rust function to handle UID checking, unless the decision is cached
+    is_blacklisted = cached_check_user_id(user_id);
 
     if (is_blacklisted) {
-        //printk(KERN_WARNING "Kprobe: Blacklisted user %d detected!\n",user_id);
-        // Add additional handling for blacklisted user ID if necessary
-        printk(KERN_INFO "rust_kprobes: vfs_open called on: %s with inode: %d\n", pathname, inode->i_ino);
+        record_event(user_id, path->dentry, inode);
+
+        if (unlikely(debug))
+            printk(KERN_INFO "rust_kprobes: Blacklisted user %u, path accessed: %s with inode: %lu\n",
+                   user_id, pathname, inode ? inode->i_ino : 0);
+    }
+
+    hook_stats_record(&handler_stats, start_ns);
+}
+
+// Adjusted function signature to match kprobe_pre_handler_t
+static int handler_pre(struct kprobe *p, struct pt_regs *regs) {
+    handle_path_access((const struct path *) regs_get_kernel_argument(regs, 0));
+    return 0;
+}
+
+// Matches fprobe_entry_cb, the ftrace based backend needs no breakpoint trap
+static int handler_entry(struct fprobe *fp, unsigned long entry_ip, unsigned long ret_ip,
+                         struct pt_regs *regs, void *entry_data) {
+    handle_path_access((const struct path *) regs_get_kernel_argument(regs, 0));
+    return 0;
+}
+
+static int register_probes(void) {
+    int i;
 
+    if (use_fprobe) {
+        fp.entry_handler = handler_entry;
+        return register_fprobe_syms(&fp, probe_symbols, PROBE_SYMBOLS);
     }
 
+    for (i = 0; i < PROBE_SYMBOLS; i++) {
+        kps[i].symbol_name = probe_symbols[i];
+        kps[i].pre_handler = handler_pre;
+        kp_list[i] = &kps[i];
+    }
+    return register_kprobes(kp_list, PROBE_SYMBOLS);
+}
+
+static void unregister_probes(void) {
+    if (use_fprobe)
+        unregister_fprobe(&fp);
+    else
+        unregister_kprobes(kp_list, PROBE_SYMBOLS);
+}
+
+// Copies the pending events of every CPU, only whole events fit in the buffer.
+// It never blocks: 0 means that there are no events right now.
+static ssize_t events_read(struct file *file, char __user *buffer, size_t len, loff_t *offset) {
+    size_t copied = 0;
+    ssize_t ret = 0;
+    int cpu;
+
+    if (len < sizeof(struct kprobe_event))
+        return -EINVAL;
+
+    mutex_lock(&events_lock);
+    for_each_possible_cpu(cpu) {
+        struct kprobe_ring *ring = per_cpu(kprobe_rings, cpu);
+        unsigned int tail = ring->tail;
+        unsigned int head = smp_load_acquire(&ring->head);
+
+        while (tail != head && len - copied >= sizeof(struct kprobe_event)) {
+            if (copy_to_user(buffer + copied, &ring->events[tail & KPROBE_RING_MASK], sizeof(struct kprobe_event))) {
+                ret = -EFAULT;
+                break;
+            }
+            copied += sizeof(struct kprobe_event);
+            tail++;
+        }
+
+        // Give the slots back to the producer
+        smp_store_release(&ring->tail, tail);
+        if (ret < 0 || len - copied < sizeof(struct kprobe_event))
+            break;
+    }
+    mutex_unlock(&events_lock);
+
+    return copied ? copied : ret;
+}
+
+static const struct file_operations events_fops = {
+    .owner = THIS_MODULE,
+    .read = events_read,
+};
+
+static struct miscdevice events_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "rust_kprobes_events",
+    .fops = &events_fops,
+    .mode = 0400,
+};
+
+static void free_rings(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        kvfree(per_cpu(kprobe_rings, cpu));
+        per_cpu(kprobe_rings, cpu) = NULL;
+    }
+}
+
+static int alloc_rings(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct kprobe_ring *ring = kvzalloc_node(sizeof(*ring), GFP_KERNEL, cpu_to_node(cpu));
+
+        if (!ring) {
+            free_rings();
+            return -ENOMEM;
+        }
+        per_cpu(kprobe_rings, cpu) = ring;
+    }
     return 0;
 }
 
 int initialize_kprobe(void) {
-    kp.pre_handler = handler_pre;
-    int ret = register_kprobe(&kp);
+    int ret;
+
+    if (!strcmp(backend, "fprobe")) {
+        if (!IS_ENABLED(CONFIG_FPROBE)) {
+            printk(KERN_ERR "rust_kprobes: fprobe backend not available (CONFIG_FPROBE)\n");
+            return -EOPNOTSUPP;
+        }
+        use_fprobe = true;
+    } else if (strcmp(backend, "kprobe")) {
+        printk(KERN_ERR "rust_kprobes: Unknown backend %s\n", backend);
+        return -EINVAL;
+    }
+
+    ret = alloc_rings();
+    if (ret < 0) {
+        printk(KERN_ERR "rust_kprobes: Failed to allocate the event rings\n");
+        return ret;
+    }
+
+    ret = misc_register(&events_device);
+    if (ret < 0) {
+        printk(KERN_ERR "rust_kprobes: Failed to register the event device\n");
+        free_rings();
+        return ret;
+    }
+
+    ret = register_probes();
     if (ret < 0) {
-        printk(KERN_ERR "rust_kprobes: Failed to register kprobe\n");
+        printk(KERN_ERR "rust_kprobes: Failed to register the %s backend\n", backend);
+        misc_deregister(&events_device);
+        free_rings();
         return ret;
     } else {
-        printk(KERN_INFO "rust_kprobes: Kprobe registered\n");
+        printk(KERN_INFO "rust_kprobes: %s backend registered on %zu symbols\n", backend, PROBE_SYMBOLS);
     }
     return 0;
 }
 EXPORT_SYMBOL(initialize_kprobe);
 
 void cleanup_kprobe(void) {
-    unregister_kprobe(&kp);
+    unregister_probes();
+    misc_deregister(&events_device);
+    free_rings();
     printk(KERN_INFO "rust_kprobes: Kprobe unregistered\n");
 }
 EXPORT_SYMBOL(cleanup_kprobe);
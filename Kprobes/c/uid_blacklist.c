@@ -0,0 +1,108 @@
+// uid_blacklist.c
+// RCU primitives and debugfs interface of the UID blacklist kept by the Rust side.
+// The blacklist is listed and replaced through /sys/kernel/debug/rust_kprobes/blacklist,
+// the statistics of the handler (kprobe_setup.c) are shown in the same directory.
+
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#define BLACKLIST_WRITE_MAX (64 * 1024)
+
+void initialize_blacklist_file(void);
+void cleanup_blacklist_file(void);
+void kprobe_rcu_read_lock(void);
+void kprobe_rcu_read_unlock(void);
+void kprobe_synchronize_rcu(void);
+
+extern int rust_load_blacklist(const char *buffer, size_t len);  // Rust function replacing the blacklist
+extern bool rust_blacklist_get(size_t index, u32 *uid);          // Rust function listing the blacklist
+extern int kprobe_stats_show(struct seq_file *m, void *v);
+
+static struct dentry *blacklist_dir;
+// Serializes the updates of the blacklist
+static DEFINE_MUTEX(blacklist_lock);
+
+void kprobe_rcu_read_lock(void) {
+    rcu_read_lock();
+}
+
+void kprobe_rcu_read_unlock(void) {
+    rcu_read_unlock();
+}
+
+void kprobe_synchronize_rcu(void) {
+    synchronize_rcu();
+}
+
+static int blacklist_show(struct seq_file *m, void *v) {
+    size_t i;
+    u32 uid;
+
+    rcu_read_lock();
+    for (i = 0; rust_blacklist_get(i, &uid); i++)
+        seq_printf(m, "%u\n", uid);
+    rcu_read_unlock();
+    return 0;
+}
+
+static int blacklist_open(struct inode *inode, struct file *file) {
+    return single_open(file, blacklist_show, NULL);
+}
+
+// Every write replaces the whole blacklist with the UIDs it contains,
+// separated by spaces, commas or newlines. An empty write clears it.
+static ssize_t blacklist_write(struct file *file, const char __user *user_buffer, size_t len, loff_t *offset) {
+    char *buffer;
+    int ret;
+
+    if (len > BLACKLIST_WRITE_MAX)
+        return -E2BIG;
+
+    buffer = memdup_user_nul(user_buffer, len);
+    if (IS_ERR(buffer))
+        return PTR_ERR(buffer);
+
+    mutex_lock(&blacklist_lock);
+    ret = rust_load_blacklist(buffer, len);
+    mutex_unlock(&blacklist_lock);
+
+    kfree(buffer);
+    return ret < 0 ? ret : len;
+}
+
+static const struct file_operations blacklist_fops = {
+    .owner = THIS_MODULE,
+    .open = blacklist_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+    .write = blacklist_write,
+};
+
+static int stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, kprobe_stats_show, NULL);
+}
+
+static const struct file_operations stats_fops = {
+    .owner = THIS_MODULE,
+    .open = stats_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+void initialize_blacklist_file(void) {
+    blacklist_dir = debugfs_create_dir("rust_kprobes", NULL);
+    debugfs_create_file("blacklist", 0600, blacklist_dir, NULL, &blacklist_fops);
+    debugfs_create_file("stats", 0444, blacklist_dir, NULL, &stats_fops);
+}
+
+void cleanup_blacklist_file(void) {
+    debugfs_remove_recursive(blacklist_dir);
+    blacklist_dir = NULL;
+}
@@ -3,9 +3,22 @@
 //! Rust out-of-tree sample, with C code inclusion
 
 use kernel::prelude::*;
+use core::ptr;
+use core::sync::atomic::{AtomicPtr, Ordering};
 
+#[path = "../../common/uid_hash.rs"]
+mod uid_hash;
+mod uid_set;
+
+use crate::uid_set::UidSet;
+
+// Blacklist loaded with the module, it can be replaced at runtime through debugfs
 const BLACKLISTED_USER_IDS: [u32; 3] = [1003, 1001, 1002];
 
+// Current blacklist, obtained from `Box::into_raw`. It is replaced with RCU:
+// the kprobe handler reads it inside a read-side critical section.
+static BLACKLIST: AtomicPtr<UidSet> = AtomicPtr::new(ptr::null_mut());
+
 module! {
     type: RustKprobes,
     name: "rust_kprobes",
@@ -20,8 +33,15 @@ impl kernel::Module for RustKprobes {
     fn init(_module: &'static ThisModule) -> Result<Self> {
         pr_info!("Rust kprobe module loaded!\n");
 
+        // The blacklist must be ready before the first vfs_open is intercepted
+        publish_blacklist(&BLACKLISTED_USER_IDS)?;
+
         // Call the C function to initialize kprobe
-        call_initialize_kprobe();
+        if let Err(e) = call_initialize_kprobe() {
+            release_blacklist();
+            return Err(e);
+        }
+        call_initialize_blacklist_file();
 
         Ok(RustKprobes)
     }
@@ -32,32 +52,133 @@ impl Drop for RustKprobes {
         pr_info!("Rust kprobe module unloaded!\n");
 
         // Call the C function to clean up kprobe
+        call_cleanup_blacklist_file();
         call_cleanup_kprobe();
+
+        // The handler is unregistered, release the blacklist
+        release_blacklist();
     }
 }
 
-// Rust function to check if a user ID is blacklisted
+fn release_blacklist() {
+    let old = BLACKLIST.swap(ptr::null_mut(), Ordering::AcqRel);
+    if !old.is_null() {
+        unsafe { kprobe_synchronize_rcu() };
+        // SAFETY: `old` comes from `Box::into_raw` and no reader can reach it anymore.
+        drop(unsafe { Box::from_raw(old) });
+    }
+}
+
+/// Replaces the blacklist with a new set containing the given user IDs.
+///
+/// The callers are serialized: the module init, and the debugfs writes under their lock.
+fn publish_blacklist(uids: &[u32]) -> Result {
+    let set = Box::new(UidSet::new(uids)?, GFP_KERNEL)?;
+    let old = BLACKLIST.swap(Box::into_raw(set), Ordering::AcqRel);
+    // The decisions cached by the handler refer to the old set
+    unsafe { kprobe_policy_changed() };
+
+    if !old.is_null() {
+        // Wait for the handlers that may still be using the old set
+        unsafe { kprobe_synchronize_rcu() };
+        // SAFETY: `old` comes from `Box::into_raw` and no reader can reach it anymore.
+        drop(unsafe { Box::from_raw(old) });
+    }
+    Ok(())
+}
+
+/// Parses the user IDs separated by spaces, commas or newlines.
+fn parse_user_ids(input: &[u8]) -> Result<Vec<u32>> {
+    let mut uids = Vec::new();
+
+    let tokens = input.split(|byte| byte.is_ascii_whitespace() || *byte == b',');
+    for token in tokens.filter(|token| !token.is_empty()) {
+        let uid = core::str::from_utf8(token)
+            .ok()
+            .and_then(|token| token.parse::<u32>().ok())
+            .ok_or(EINVAL)?;
+        uids.push(uid, GFP_KERNEL)?;
+    }
+
+    Ok(uids)
+}
+
+// Called by the debugfs write handler (c/uid_blacklist.c), with its lock held
 #[no_mangle]
-pub extern "C" fn check_user_id(user_id: u32) -> bool {
-    if BLACKLISTED_USER_IDS.contains(&user_id){
-        pr_warn!("Kprobe: Blacklisted user {} detected!\n",user_id);    
-        true
+pub extern "C" fn rust_load_blacklist(buffer: *const u8, len: usize) -> i32 {
+    // SAFETY: the C side passes a kernel copy of the written data, of `len` bytes.
+    let input = unsafe { core::slice::from_raw_parts(buffer, len) };
+
+    let result = match parse_user_ids(input) {
+        Ok(uids) => publish_blacklist(&uids),
+        Err(e) => Err(e),
+    };
+    match result {
+        Ok(()) => 0,
+        Err(e) => e.to_errno(),
     }
-    else{
-        false
+}
+
+// Called by the debugfs read handler inside an RCU read-side critical section
+#[no_mangle]
+pub extern "C" fn rust_blacklist_get(index: usize, uid: *mut u32) -> bool {
+    let set = BLACKLIST.load(Ordering::Acquire);
+    if set.is_null() {
+        return false;
     }
+
+    // SAFETY: the set is released only after a grace period, the caller holds the RCU read lock.
+    match unsafe { &*set }.get(index) {
+        Some(value) => {
+            // SAFETY: `uid` points to a variable of the caller.
+            unsafe { *uid = value };
+            true
+        }
+        None => false,
+    }
+}
+
+// Rust function to check if a user ID is blacklisted
+#[no_mangle]
+pub extern "C" fn check_user_id(user_id: u32) -> bool {
+    unsafe { kprobe_rcu_read_lock() };
+    let set = BLACKLIST.load(Ordering::Acquire);
+    // SAFETY: the set is released only after a grace period, it is not used past the unlock.
+    let is_blacklisted = !set.is_null() && unsafe { &*set }.contains(user_id);
+    unsafe { kprobe_rcu_read_unlock() };
+
+    // Called on every vfs_open: no logging here, the C handler records the event
+    is_blacklisted
 }
 
 // FFI declarations
 extern "C" {
-    fn initialize_kprobe();
+    fn initialize_kprobe() -> i32;
     fn cleanup_kprobe();
+    fn initialize_blacklist_file();
+    fn cleanup_blacklist_file();
+    fn kprobe_rcu_read_lock();
+    fn kprobe_rcu_read_unlock();
+    fn kprobe_synchronize_rcu();
+    fn kprobe_policy_changed();
 }
 
-pub fn call_initialize_kprobe() {
-    unsafe { initialize_kprobe() }
+pub fn call_initialize_kprobe() -> Result {
+    let ret = unsafe { initialize_kprobe() };
+    if ret < 0 {
+        return Err(Error::from_errno(ret));
+    }
+    Ok(())
 }
 
 pub fn call_cleanup_kprobe() {
     unsafe { cleanup_kprobe() }
 }
+
+pub fn call_initialize_blacklist_file() {
+    unsafe { initialize_blacklist_file() }
+}
+
+pub fn call_cleanup_blacklist_file() {
+    unsafe { cleanup_blacklist_file() }
+}
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-2.0
+// uid_set.rs
+//! Set of the blacklisted user IDs, checked by the kprobe on every `vfs_open`.
+
+use kernel::prelude::*;
+
+use crate::uid_hash::hash_uid;
+
+/// Marker of the free slots: `(uid_t)-1` is never a valid user ID.
+const EMPTY_SLOT: u32 = u32::MAX;
+
+/// Immutable hash set of user IDs, using open addressing with linear probing.
+///
+/// The set is never modified: every update builds a new one, published with RCU,
+/// so the kprobe handler reads it without any lock.
+pub struct UidSet {
+    slots: Vec<u32>,
+    /// The same user IDs, sorted, used to list the set.
+    uids: Vec<u32>,
+}
+
+impl UidSet {
+    pub fn new(uids: &[u32]) -> Result<Self> {
+        let mut sorted = Vec::with_capacity(uids.len(), GFP_KERNEL)?;
+        sorted.extend_from_slice(uids, GFP_KERNEL)?;
+        sorted.sort_unstable();
+        sorted.dedup();
+        sorted.retain(|&uid| uid != EMPTY_SLOT);
+
+        // At most half full, a lookup stops after a couple of probes on average
+        let capacity = if sorted.is_empty() { 0 } else { (sorted.len() * 2).next_power_of_two() };
+        let mut slots = Vec::with_capacity(capacity, GFP_KERNEL)?;
+        for _ in 0..capacity {
+            slots.push(EMPTY_SLOT, GFP_KERNEL)?;
+        }
+
+        let mut set = Self { slots, uids: Vec::new() };
+        for &uid in sorted.iter() {
+            let mut i = set.bucket(uid);
+            while set.slots[i] != EMPTY_SLOT {
+                i = (i + 1) & (capacity - 1);
+            }
+            set.slots[i] = uid;
+        }
+        set.uids = sorted;
+
+        Ok(set)
+    }
+
+    /// Home slot of the given user ID.
+    fn bucket(&self, uid: u32) -> usize {
+        hash_uid(uid, self.slots.len())
+    }
+
+    pub fn contains(&self, uid: u32) -> bool {
+        if self.slots.is_empty() || uid == EMPTY_SLOT {
+            return false;
+        }
+
+        let mask = self.slots.len() - 1;
+        let mut i = self.bucket(uid);
+        loop {
+            match self.slots[i] {
+                EMPTY_SLOT => return false,
+                slot if slot == uid => return true,
+                _ => i = (i + 1) & mask,
+            }
+        }
+    }
+
+    /// Returns the user ID at the given position, in ascending order.
+    pub fn get(&self, index: usize) -> Option<u32> {
+        self.uids.get(index).copied()
+    }
+}
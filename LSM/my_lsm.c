@@ -5,40 +5,334 @@
 #include <linux/sched.h>
 #include <linux/cred.h>
 #include <linux/lsm_hooks.h>
+#include <linux/debugfs.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/workqueue.h>
+#include <linux/dcache.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+
+#include "sec_rules.h"
+#include "hook_stats.h"
 
 
 // Define a unique LSM ID
 #define LSM_ID_MY_LSM 1001
 
+// Denials logged per interval, the others are only counted
+#define AUDIT_BATCH 32
+#define AUDIT_INTERVAL HZ
+#define AUDIT_NAME_LEN 32
+
+// Mode of the LSM, chosen at boot with my_lsm.mode= (or at load time with mode=):
+//  - permissive (default): nothing is denied, the denials are only audited
+//  - enforce: the denials are audited and the access fails with -EACCES
+static char *mode = "permissive";
+module_param(mode, charp, 0444);
+MODULE_PARM_DESC(mode, "permissive (audit only, default) or enforce");
+
+static bool enforce;
+
+// Denials are not logged from the hooks: they are batched in the audit buffer,
+// which is flushed to the kernel log at most once per interval.
+struct audit_record {
+    uid_t uid;
+    char comm[TASK_COMM_LEN];
+    char name[AUDIT_NAME_LEN];
+};
+
+static struct audit_record audit_buffer[AUDIT_BATCH];
+// Copy printed by the flush, the work item never runs concurrently with itself
+static struct audit_record audit_flushed[AUDIT_BATCH];
+static unsigned int audit_count;
+static unsigned long audit_suppressed;
+static DEFINE_SPINLOCK(audit_lock);
+
+static void audit_flush(struct work_struct *work);
+static DECLARE_DELAYED_WORK(audit_work, audit_flush);
+
+// Policy of the rule store (sec_module), registered when that module is loaded.
+// Without it every access is allowed.
+struct my_lsm_policy {
+    const struct sec_policy_ops *ops;
+    // Added to the generations of the rules: the versions of a policy registered
+    // later never overlap with the ones of the previous policies
+    u64 base;
+};
+
+static struct my_lsm_policy __rcu *policy;
+static DEFINE_MUTEX(policy_lock);
+// Per-CPU buffers used to build the paths checked against the policy
+static char __percpu *path_buffers;
+
+int my_lsm_set_policy(const struct sec_policy_ops *ops);
+
+// Decision cached in the security blob of each open file, in a single word so that it is
+// read and written atomically: denied bit (63) and the version of the policy (62-0) it was
+// computed with. Version 0 is never used, a zeroed blob holds no decision. A rule change
+// changes the version, the cached decisions are then recomputed lazily on the next check.
+#define DECISION_DENIED (1ULL << 63)
+
+struct my_lsm_file_blob {
+    u64 decision;
+};
+
+// The blobs are reserved by the LSM framework only for the LSMs built into the kernel
+#ifndef MODULE
+struct lsm_blob_sizes my_lsm_blob_sizes __ro_after_init = {
+    .lbs_file = sizeof(struct my_lsm_file_blob),
+};
+
+static struct my_lsm_file_blob *my_lsm_file(const struct file *file)
+{
+    if (unlikely(!file->f_security))
+        return NULL;
+    return file->f_security + my_lsm_blob_sizes.lbs_file;
+}
+#else
+static struct my_lsm_file_blob *my_lsm_file(const struct file *file)
+{
+    return NULL;
+}
+#endif
+
+// Cost of each hook, printed by /sys/kernel/debug/my_lsm/stats
+static DEFINE_PER_CPU(struct hook_stats, file_open_stats);
+static DEFINE_PER_CPU(struct hook_stats, inode_permission_stats);
+static DEFINE_PER_CPU(struct hook_stats, file_permission_stats);
+
+static struct dentry *my_lsm_debugfs_dir;
+
+static int my_lsm_stats_show(struct seq_file *m, void *v)
+{
+    hook_stats_print(m, "file_open", &file_open_stats);
+    hook_stats_print(m, "inode_permission", &inode_permission_stats);
+    hook_stats_print(m, "file_permission", &file_permission_stats);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(my_lsm_stats);
+
+static void audit_flush(struct work_struct *work)
+{
+    unsigned int count, i;
+    unsigned long suppressed;
+
+    spin_lock(&audit_lock);
+    count = audit_count;
+    suppressed = audit_suppressed;
+    memcpy(audit_flushed, audit_buffer, count * sizeof(struct audit_record));
+    audit_count = 0;
+    audit_suppressed = 0;
+    spin_unlock(&audit_lock);
+
+    for (i = 0; i < count; i++)
+        pr_info("My LSM: Access %s for process %s (UID: %d) on %s\n", enforce ? "denied" : "audited",
+                audit_flushed[i].comm, audit_flushed[i].uid, audit_flushed[i].name);
+    if (suppressed)
+        pr_info("My LSM: %lu more denials not logged\n", suppressed);
+}
+
+// Records a denial, the first one of an interval schedules the flush
+static void audit_deny(uid_t uid, const char *name)
+{
+    struct audit_record *record;
+
+    spin_lock(&audit_lock);
+    if (audit_count == AUDIT_BATCH) {
+        audit_suppressed++;
+        spin_unlock(&audit_lock);
+        return;
+    }
+
+    record = &audit_buffer[audit_count++];
+    record->uid = uid;
+    get_task_comm(record->comm, current);
+    strscpy(record->name, name, sizeof(record->name));
+    if (audit_count == 1)
+        schedule_delayed_work(&audit_work, AUDIT_INTERVAL);
+    spin_unlock(&audit_lock);
+}
+
+// Called by sec_module with its policy when it is loaded, and with NULL when it is unloaded
+int my_lsm_set_policy(const struct sec_policy_ops *ops)
+{
+    static u64 next_base = 1;
+    struct my_lsm_policy *old, *new = NULL;
+
+    if (ops) {
+        new = kmalloc(sizeof(*new), GFP_KERNEL);
+        if (!new)
+            return -ENOMEM;
+        new->ops = ops;
+    }
+
+    mutex_lock(&policy_lock);
+    old = rcu_dereference_protected(policy, lockdep_is_held(&policy_lock));
+    // The old policy is still loaded: its last generation bounds the versions already cached
+    if (old)
+        next_base = old->base + old->ops->generation() + 1;
+    if (new)
+        new->base = next_base;
+    rcu_assign_pointer(policy, new);
+    mutex_unlock(&policy_lock);
+
+    // Wait for the hooks still using the old policy
+    synchronize_rcu();
+    kfree(old);
+
+    pr_info("My LSM: Policy %s\n", ops ? "registered" : "unregistered");
+    return 0;
+}
+EXPORT_SYMBOL_GPL(my_lsm_set_policy);
+
+// Returns true if the user has path rules. If version is not NULL, it receives the
+// version of the policy used to tag the cached decisions, 0 without a policy.
+static bool policy_has_rules(uid_t uid, u64 *version)
+{
+    const struct my_lsm_policy *p;
+    bool has_rules = false;
+
+    if (version)
+        *version = 0;
+
+    rcu_read_lock();
+    p = rcu_dereference(policy);
+    if (p && path_buffers) {
+        has_rules = p->ops->has_rules(uid);
+        if (version)
+            *version = p->base + p->ops->generation();
+    }
+    rcu_read_unlock();
+    return has_rules;
+}
+
+// Version of the policy, 0 without a policy
+static u64 policy_version(void)
+{
+    const struct my_lsm_policy *p;
+    u64 version = 0;
+
+    rcu_read_lock();
+    p = rcu_dereference(policy);
+    if (p && path_buffers)
+        version = p->base + p->ops->generation();
+    rcu_read_unlock();
+    return version;
+}
+
+// Checks the absolute path against the policy. The path is built in the buffer of the CPU:
+// the check never sleeps, so it is done entirely with preemption disabled.
+static int policy_check(uid_t uid, const struct path *path)
+{
+    const struct my_lsm_policy *p;
+    char *buffer, *name;
+    int ret = 0;
+
+    rcu_read_lock();
+    p = rcu_dereference(policy);
+    if (p && path_buffers) {
+        buffer = get_cpu_ptr(path_buffers);
+        name = d_path(path, buffer, PATH_MAX);
+        if (!IS_ERR(name))
+            ret = p->ops->check(uid, name);
+        put_cpu_ptr(path_buffers);
+    }
+    rcu_read_unlock();
+    return ret;
+}
+
 // Define the file open hook
 static int my_file_open(struct file *file)
 {
+    struct my_lsm_file_blob *blob = my_lsm_file(file);
     const struct cred *cred;
+    bool denied;
     uid_t uid;
-    const char *process_name;
+    u64 version;
+    int ret = 0;
+    u64 start_ns = ktime_get_ns();
 
     // Get the current process credentials
     cred = current_cred();
     uid = cred->uid.val;
-    process_name = current->comm;
 
-    pr_info("My LSM: File open intercepted by process %s (UID: %d)\n", process_name, uid);
+    // The allowed opens are not logged, the users without path rules cost a lookup.
+    // The version is read first: if the rules change meanwhile, the decision cached
+    // here is already stale and file_permission computes it again.
+    denied = unlikely(policy_has_rules(uid, &version)) && policy_check(uid, &file->f_path);
+    if (blob && version)
+        WRITE_ONCE(blob->decision, version | (denied ? DECISION_DENIED : 0));
+
+    if (denied) {
+        audit_deny(uid, file->f_path.dentry->d_name.name);
+        if (enforce)
+            ret = -EACCES;
+    }
+
+    hook_stats_record(&file_open_stats, start_ns);
+    return ret;
+}
+
+// Define the hook checking each read and write of an open file
+static int my_file_permission(struct file *file, int mask)
+{
+    struct my_lsm_file_blob *blob = my_lsm_file(file);
+    uid_t uid = file->f_cred->uid.val;
+    bool denied;
+    u64 cached, version;
+    int ret = 0;
+    u64 start_ns = ktime_get_ns();
+
+    // Without the blobs (built as a module) the rules are only checked at open
+    if (!blob)
+        goto out;
 
-    // Implement your access control logic here
-    // Example: Deny access if the user ID is 1000 (non-root user)
-    if (uid == 1000) {
-        pr_info("My LSM: Access denied for process %s (UID: %d)\n", process_name, uid);
-        //return -EACCES;
+    // While the rules do not change the decision taken at open is a compare
+    version = policy_version();
+    cached = READ_ONCE(blob->decision);
+    if (likely((cached & ~DECISION_DENIED) == version)) {
+        denied = cached & DECISION_DENIED;
+    } else {
+        // Rules changed since the last check: computed again for the user who opened
+        // the file, the denials are logged only when the decision is taken
+        denied = policy_has_rules(uid, &version) && policy_check(uid, &file->f_path);
+        WRITE_ONCE(blob->decision, version | (denied ? DECISION_DENIED : 0));
+        if (denied)
+            audit_deny(uid, file->f_path.dentry->d_name.name);
     }
 
+    if (denied && enforce)
+        ret = -EACCES;
+
+out:
+    hook_stats_record(&file_permission_stats, start_ns);
+    return ret;
+}
+
+// The file blobs are not zeroed by the LSM framework
+static int my_file_alloc_security(struct file *file)
+{
+    struct my_lsm_file_blob *blob = my_lsm_file(file);
+
+    if (blob)
+        blob->decision = 0;
     return 0;
 }
 
 // Define another LSM hook for inode permission
 static int my_inode_permission(struct inode *inode, int mask)
 {
-    pr_info("My LSM: Inode permission intercepted\n");
-    // Implement your access control logic here
+    u64 start_ns = ktime_get_ns();
+
+    // Called several times for each path walk: nothing to check and nothing logged.
+    // The rules are absolute paths and the inode has none, they are checked in file_open.
+    hook_stats_record(&inode_permission_stats, start_ns);
     return 0;
 }
 
@@ -46,6 +340,8 @@ static int my_inode_permission(struct inode *inode, int mask)
 static struct security_hook_list my_hooks[] = {
     LSM_HOOK_INIT(file_open, my_file_open),
     LSM_HOOK_INIT(inode_permission, my_inode_permission),
+    LSM_HOOK_INIT(file_alloc_security, my_file_alloc_security),
+    LSM_HOOK_INIT(file_permission, my_file_permission),
 };
 
 // Define the LSM identifier
@@ -54,21 +350,59 @@ static struct lsm_id my_lsm_id = {
     .id = LSM_ID_MY_LSM
 };
 
+static int __init my_lsm_debugfs_init(void)
+{
+    // The statistics are optional: if debugfs is not available the hooks work anyway
+    my_lsm_debugfs_dir = debugfs_create_dir("my_lsm", NULL);
+    debugfs_create_file("stats", 0444, my_lsm_debugfs_dir, NULL, &my_lsm_stats_fops);
+    return 0;
+}
+
 static int __init my_lsm_init(void)
 {
-    pr_info("My LSM: Initializing...\n");
+    if (!strcmp(mode, "enforce")) {
+        enforce = true;
+    } else if (strcmp(mode, "permissive")) {
+        pr_warn("My LSM: Unknown mode %s, using permissive\n", mode);
+    }
+
+    pr_info("My LSM: Initializing in %s mode...\n", enforce ? "enforce" : "permissive");
+
+    // Without the buffers the policy is never evaluated and every access is allowed
+    path_buffers = __alloc_percpu(PATH_MAX, 1);
+    if (!path_buffers)
+        pr_warn("My LSM: Failed to allocate the path buffers\n");
     // Register the hooks
     security_add_hooks(my_hooks, ARRAY_SIZE(my_hooks), &my_lsm_id);
+
+#ifdef MODULE
+    my_lsm_debugfs_init();
+#endif
     return 0;
 }
 
+#ifndef MODULE
+// Built into the kernel: registered by the LSM framework, which reserves the blobs
+DEFINE_LSM(my_lsm) = {
+    .name = "my_lsm",
+    .init = my_lsm_init,
+    .blobs = &my_lsm_blob_sizes,
+};
+
+// The LSMs are initialized before debugfs
+fs_initcall(my_lsm_debugfs_init);
+#else
 // Use the core_initcall to ensure early initialization
 core_initcall(my_lsm_init);
+#endif
 
 static void __exit my_lsm_exit(void)
 {
     pr_info("My LSM: Exiting...\n");
     // Cleanup code if necessary
+    debugfs_remove_recursive(my_lsm_debugfs_dir);
+    flush_delayed_work(&audit_work);
+    free_percpu(path_buffers);
 }
 
 module_exit(my_lsm_exit);
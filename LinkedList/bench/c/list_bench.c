@@ -0,0 +1,213 @@
+// list_bench.c
+// Parameters, native list_head phases and debugfs interface of the list benchmark.
+// The same phases are run on the Rust ListHead abstraction by src/list_bench.rs, which
+// computes the statistics; the report is read from /sys/kernel/debug/list_bench/results
+// and a new run (with the current parameters) is started by writing to .../run.
+
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+
+// Phases of a run. Add, iterate and delete always run (they build, walk and free the
+// list), the phases parameter only selects what is measured and reported. The
+// iterate_prefetch, iterate_batch and iterate_parallel variants only exist on the Rust side.
+#define LIST_BENCH_ADD 0
+#define LIST_BENCH_ITERATE 1
+#define LIST_BENCH_REPLACE 2
+#define LIST_BENCH_DELETE 3
+#define LIST_BENCH_ITERATE_PREFETCH 4
+#define LIST_BENCH_ITERATE_BATCH 5
+#define LIST_BENCH_ITERATE_PARALLEL 6
+#define LIST_BENCH_PHASES 7
+
+static unsigned int size = 1000000;
+module_param(size, uint, 0644);
+MODULE_PARM_DESC(size, "Number of elements of the list");
+
+static unsigned int iterations = 10;
+module_param(iterations, uint, 0644);
+MODULE_PARM_DESC(iterations, "Measured runs of each implementation");
+
+static unsigned int warmup = 2;
+module_param(warmup, uint, 0644);
+MODULE_PARM_DESC(warmup, "Runs discarded before the measured ones");
+
+static unsigned int phases = (1 << LIST_BENCH_PHASES) - 1;
+module_param(phases, uint, 0644);
+MODULE_PARM_DESC(phases, "Reported phases, bitmask: 1 add, 2 iterate, 4 replace, 8 delete, 16 iterate_prefetch, 32 iterate_batch, 64 iterate_parallel");
+
+static unsigned int prefetch = 8;
+module_param(prefetch, uint, 0644);
+MODULE_PARM_DESC(prefetch, "Distance in nodes of the prefetches in the iterate_prefetch phase");
+
+static unsigned int segments = 4;
+module_param(segments, uint, 0644);
+MODULE_PARM_DESC(segments, "Segments processed in parallel in the iterate_parallel phase");
+
+struct list_bench_params {
+    u32 size;
+    u32 iterations;
+    u32 warmup;
+    u32 phases;
+    u32 prefetch;
+    u32 segments;
+};
+
+struct list_bench_item {
+    struct list_head list;
+    u32 data;
+};
+
+void list_bench_get_params(struct list_bench_params *params);
+int list_bench_native_run(u32 size, bool replace, u64 *phase_ns);
+void list_bench_publish(const char *report, size_t len);
+long list_bench_run(void);
+void list_bench_debugfs_init(void);
+void list_bench_debugfs_cleanup(void);
+
+extern long rust_list_bench_run(void);  // Rust function running both implementations
+
+static struct dentry *bench_dir;
+// Serializes the runs and protects the report
+static DEFINE_MUTEX(bench_lock);
+static char *results;
+static size_t results_len;
+
+// Snapshot of the parameters, they can be changed through sysfs between two runs
+void list_bench_get_params(struct list_bench_params *params) {
+    params->size = READ_ONCE(size);
+    params->iterations = READ_ONCE(iterations);
+    params->warmup = READ_ONCE(warmup);
+    params->phases = READ_ONCE(phases);
+    params->prefetch = READ_ONCE(prefetch);
+    params->segments = READ_ONCE(segments);
+}
+
+static void free_items(struct list_head *head) {
+    struct list_bench_item *item, *tmp;
+
+    list_for_each_entry_safe(item, tmp, head, list) {
+        list_del(&item->list);
+        kfree(item);
+    }
+}
+
+// One run on the native list_head, phase_ns[LIST_BENCH_PHASES] gets the duration of each phase
+int list_bench_native_run(u32 size, bool replace, u64 *phase_ns) {
+    struct list_bench_item *item, *tmp;
+    LIST_HEAD(head);
+    u64 start, sum = 0;
+    u32 i;
+
+    start = ktime_get_ns();
+    for (i = 0; i < size; i++) {
+        item = kmalloc(sizeof(*item), GFP_KERNEL);
+        if (!item) {
+            free_items(&head);
+            return -ENOMEM;
+        }
+        item->data = i;
+        list_add_tail(&item->list, &head);
+    }
+    phase_ns[LIST_BENCH_ADD] = ktime_get_ns() - start;
+
+    start = ktime_get_ns();
+    list_for_each_entry(item, &head, list) {
+        item->data += 1;
+        sum += item->data;
+    }
+    phase_ns[LIST_BENCH_ITERATE] = ktime_get_ns() - start;
+    // Keeps the loop from being dropped
+    OPTIMIZER_HIDE_VAR(sum);
+
+    phase_ns[LIST_BENCH_REPLACE] = 0;
+    if (replace) {
+        i = 1;
+        start = ktime_get_ns();
+        list_for_each_entry_safe(item, tmp, &head, list) {
+            struct list_bench_item *replacement = kmalloc(sizeof(*replacement), GFP_KERNEL);
+
+            if (!replacement) {
+                free_items(&head);
+                return -ENOMEM;
+            }
+            replacement->data = i++;
+            list_replace(&item->list, &replacement->list);
+            kfree(item);
+        }
+        phase_ns[LIST_BENCH_REPLACE] = ktime_get_ns() - start;
+    }
+
+    start = ktime_get_ns();
+    free_items(&head);
+    phase_ns[LIST_BENCH_DELETE] = ktime_get_ns() - start;
+
+    cond_resched();
+    return 0;
+}
+
+// Replaces the report, called by the Rust side at the end of a run (bench_lock held)
+void list_bench_publish(const char *report, size_t len) {
+    char *copy = kvmalloc(len, GFP_KERNEL);
+
+    if (!copy)
+        return;
+    memcpy(copy, report, len);
+
+    kvfree(results);
+    results = copy;
+    results_len = len;
+}
+
+long list_bench_run(void) {
+    long ret;
+
+    mutex_lock(&bench_lock);
+    ret = rust_list_bench_run();
+    mutex_unlock(&bench_lock);
+    return ret;
+}
+
+static ssize_t results_read(struct file *file, char __user *user_buffer, size_t len, loff_t *offset) {
+    ssize_t ret;
+
+    mutex_lock(&bench_lock);
+    ret = simple_read_from_buffer(user_buffer, len, offset, results, results_len);
+    mutex_unlock(&bench_lock);
+    return ret;
+}
+
+// Any write starts a new run, it returns when the run is over
+static ssize_t run_write(struct file *file, const char __user *user_buffer, size_t len, loff_t *offset) {
+    long ret = list_bench_run();
+
+    return ret < 0 ? ret : len;
+}
+
+static const struct file_operations results_fops = {
+    .owner = THIS_MODULE,
+    .read = results_read,
+};
+
+static const struct file_operations run_fops = {
+    .owner = THIS_MODULE,
+    .write = run_write,
+};
+
+void list_bench_debugfs_init(void) {
+    bench_dir = debugfs_create_dir("list_bench", NULL);
+    debugfs_create_file("results", 0444, bench_dir, NULL, &results_fops);
+    debugfs_create_file("run", 0200, bench_dir, NULL, &run_fops);
+}
+
+void list_bench_debugfs_cleanup(void) {
+    debugfs_remove_recursive(bench_dir);
+    kvfree(results);
+    results = NULL;
+}
@@ -0,0 +1,431 @@
+// list_bench.rs
+
+// SPDX-License-Identifier: GPL-2.0
+
+//! Linked List Benchmark Module
+//!
+//! Runs the same phases (add, iterate, replace, delete, plus the prefetching, batched
+//! and parallel iterations on the Rust side) on the `ListHead` abstraction,
+//! with one allocation per node and with a `ListPool`, and on the native `list_head`
+//! (c/list_bench.c), repeated `iterations` times after
+//! `warmup` discarded runs. The cost of each phase is reported in ns per element, with
+//! percentiles and standard deviation, in /sys/kernel/debug/list_bench/results.
+
+use core::fmt::Write;
+use kernel::{prelude::*, time::Ktime, linked_list::*};
+use kernel::container_of;
+
+module! {
+    type: ListBench,
+    name: "list_bench",
+    author: "Luca Saverio Esposito",
+    description: "Benchmark of the linked list abstraction against the C list",
+    license: "GPL v2",
+}
+
+const PHASE_ADD: usize = 0;
+const PHASE_ITERATE: usize = 1;
+const PHASE_REPLACE: usize = 2;
+const PHASE_DELETE: usize = 3;
+const PHASE_ITERATE_PREFETCH: usize = 4;
+const PHASE_ITERATE_BATCH: usize = 5;
+const PHASE_ITERATE_PARALLEL: usize = 6;
+const PHASES: usize = 7;
+const PHASE_NAMES: [&str; PHASES] = [
+    "add", "iterate", "replace", "delete", "iterate_prefetch", "iterate_batch", "iterate_parallel",
+];
+/// Order of the phases in the report, the same as the execution.
+const PHASE_ORDER: [usize; PHASES] = [
+    PHASE_ADD, PHASE_ITERATE, PHASE_ITERATE_PREFETCH, PHASE_ITERATE_BATCH, PHASE_ITERATE_PARALLEL,
+    PHASE_REPLACE, PHASE_DELETE,
+];
+/// Phases run by the native implementation, the iteration variants are Rust only.
+const NATIVE_PHASES: u32 = (1 << PHASE_ADD) | (1 << PHASE_ITERATE) | (1 << PHASE_REPLACE) | (1 << PHASE_DELETE);
+/// Elements per batch of `ListCursor` in the iterate_batch phase.
+const BATCH_LEN: usize = 64;
+
+/// Implementations compared by the benchmark: index 0 is Rust with one allocation
+/// per node, 1 is C, 2 is Rust with the nodes taken from a `ListPool`.
+const IMPL_NAMES: [&str; IMPLS] = ["rust", "c", "rust_pool"];
+const IMPLS: usize = 3;
+
+/// Same layout as `struct list_bench_params` in c/list_bench.c.
+#[repr(C)]
+#[derive(Default)]
+struct BenchParams {
+    size: u32,
+    iterations: u32,
+    warmup: u32,
+    phases: u32,
+    prefetch: u32,
+    segments: u32,
+}
+
+extern "C" {
+    fn list_bench_get_params(params: *mut BenchParams);
+    fn list_bench_native_run(size: u32, replace: bool, phase_ns: *mut u64) -> i32;
+    fn list_bench_publish(report: *const u8, len: usize);
+    fn list_bench_run() -> isize;
+    fn list_bench_debugfs_init();
+    fn list_bench_debugfs_cleanup();
+}
+
+struct ListBench;
+
+impl kernel::Module for ListBench {
+    fn init(_module: &'static ThisModule) -> Result<Self> {
+        pr_info!("Starting Linked List Benchmark...\n");
+
+        // SAFETY: FFI calls, the first run starts once the debugfs files exist.
+        unsafe { list_bench_debugfs_init() };
+        let ret = unsafe { list_bench_run() };
+        if ret < 0 {
+            pr_err!("Benchmark run failed: {}\n", ret);
+        }
+
+        Ok(ListBench)
+    }
+}
+
+impl Drop for ListBench {
+    fn drop(&mut self) {
+        // SAFETY: FFI call, no run can start once the files are removed.
+        unsafe { list_bench_debugfs_cleanup() };
+        pr_info!("Module unloaded\n");
+    }
+}
+
+/// Element of the benchmarked lists, same layout as `struct list_bench_item`.
+struct BenchItem {
+    list: ListHead,
+    data: u32,
+}
+
+impl BenchItem {
+    fn new(data: u32) -> Self {
+        // The list pointers are set when the item is linked
+        BenchItem {
+            list: ListHead::new_uninitialized(),
+            data: data,
+        }
+    }
+}
+
+// SAFETY: the items are only accessed by one thread at a time, the parallel phase
+// hands each segment of the list to a single work.
+unsafe impl Send for BenchItem {}
+
+impl ListEntry for BenchItem {
+    unsafe fn parent_from_list_head(ptr: *mut ListHead) -> *mut Self {
+        container_of!(ptr, BenchItem, list) as *mut BenchItem
+    }
+
+    fn get_list_head(&mut self) -> *mut ListHead {
+        &mut self.list as *mut ListHead
+    }
+}
+
+fn now_ns() -> u64 {
+    Ktime::ktime_get().to_ns() as u64
+}
+
+/// Unlinks and frees every element of the list.
+fn free_items(head: &mut ListHead) {
+    let head_ptr = head as *mut ListHead;
+    let mut iter = ListIterator::<BenchItem>::new(head_ptr);
+    while let Some(item) = iter.next() {
+        head.del(item.get_list_head());
+        // SAFETY: every element has been allocated by `Box::into_raw` in `rust_run`.
+        drop(unsafe { Box::from_raw(item as *mut BenchItem) });
+    }
+}
+
+/// Iteration phases of the Rust runs, the variants are run only when reported.
+fn iterate_phases(head_ptr: *mut ListHead, params: &BenchParams, phase_ns: &mut [u64; PHASES]) {
+    let start = now_ns();
+    let mut sum = 0u64;
+    for item in ListIterator::<BenchItem>::new(head_ptr) {
+        item.data += 1;
+        sum += item.data as u64;
+    }
+    phase_ns[PHASE_ITERATE] = now_ns() - start;
+
+    if params.phases & (1 << PHASE_ITERATE_PREFETCH) != 0 {
+        let start = now_ns();
+        for item in PrefetchListIterator::<BenchItem>::new(head_ptr, params.prefetch as usize) {
+            item.data += 1;
+            sum += item.data as u64;
+        }
+        phase_ns[PHASE_ITERATE_PREFETCH] = now_ns() - start;
+    }
+
+    if params.phases & (1 << PHASE_ITERATE_BATCH) != 0 {
+        let start = now_ns();
+        let mut cursor = ListCursor::<BenchItem>::new(head_ptr);
+        let mut batch = [core::ptr::null_mut(); BATCH_LEN];
+        loop {
+            let items = cursor.next_batch(&mut batch);
+            if items.is_empty() {
+                break;
+            }
+            for &item in items {
+                // SAFETY: the cursor returns the elements of the list, which are alive.
+                let item = unsafe { &mut *item };
+                item.data += 1;
+                sum += item.data as u64;
+            }
+        }
+        phase_ns[PHASE_ITERATE_BATCH] = now_ns() - start;
+    }
+
+    if params.phases & (1 << PHASE_ITERATE_PARALLEL) != 0 {
+        let start = now_ns();
+        // SAFETY: the list head outlives the call, nothing else accesses the list meanwhile.
+        let head = unsafe { &mut *head_ptr };
+        // The length is known, the list is not counted again. On allocation failure
+        // the list is left untouched, the phase is just not timed
+        let len = Some(params.size as usize);
+        if parallel_for_each::<BenchItem, _>(head, len, params.segments as usize, &|item| item.data += 1).is_ok() {
+            phase_ns[PHASE_ITERATE_PARALLEL] = now_ns() - start;
+        }
+    }
+
+    // Keeps the loops from being dropped, the items are freed right after
+    core::hint::black_box(sum);
+}
+
+/// One run on the `ListHead` abstraction, it mirrors `list_bench_native_run`.
+fn rust_run(params: &BenchParams, phase_ns: &mut [u64; PHASES]) -> Result {
+    let mut head = ListHead::new_uninitialized();
+    head.init();
+    let head_ptr = &mut head as *mut ListHead;
+
+    let start = now_ns();
+    for i in 0..params.size {
+        let item = match Box::new(BenchItem::new(i), GFP_KERNEL) {
+            Ok(item) => Box::into_raw(item),
+            Err(e) => {
+                free_items(&mut head);
+                return Err(e.into());
+            }
+        };
+        // SAFETY: the item has just been allocated and it is owned by the list from now on.
+        head.add_tail(unsafe { (*item).get_list_head() });
+    }
+    phase_ns[PHASE_ADD] = now_ns() - start;
+
+    iterate_phases(head_ptr, params, phase_ns);
+
+    if params.phases & (1 << PHASE_REPLACE) != 0 {
+        let start = now_ns();
+        let mut iter = ListIterator::<BenchItem>::new(head_ptr);
+        let mut i = 1;
+        while let Some(item) = iter.next() {
+            let replacement = match Box::new(BenchItem::new(i), GFP_KERNEL) {
+                Ok(replacement) => Box::into_raw(replacement),
+                Err(e) => {
+                    free_items(&mut head);
+                    return Err(e.into());
+                }
+            };
+            // SAFETY: the replacement takes the place of the item, which is no longer linked.
+            unsafe {
+                head.replace(item.get_list_head(), (*replacement).get_list_head());
+                drop(Box::from_raw(item as *mut BenchItem));
+            }
+            i += 1;
+        }
+        phase_ns[PHASE_REPLACE] = now_ns() - start;
+    }
+
+    let start = now_ns();
+    free_items(&mut head);
+    phase_ns[PHASE_DELETE] = now_ns() - start;
+
+    Ok(())
+}
+
+/// One run on the `ListHead` abstraction with the nodes allocated from a `ListPool`.
+fn rust_pool_run(params: &BenchParams, phase_ns: &mut [u64; PHASES]) -> Result {
+    let mut pool = ListPool::<BenchItem>::new();
+    let mut head = ListHead::new_uninitialized();
+    head.init();
+    let head_ptr = &mut head as *mut ListHead;
+
+    let start = now_ns();
+    for i in 0..params.size {
+        // On failure the pool releases the nodes already linked when it is dropped
+        let item = pool.alloc(BenchItem::new(i))?;
+        // SAFETY: the item has just been allocated from the pool.
+        head.add_tail(unsafe { (*item).get_list_head() });
+    }
+    phase_ns[PHASE_ADD] = now_ns() - start;
+
+    iterate_phases(head_ptr, params, phase_ns);
+
+    if params.phases & (1 << PHASE_REPLACE) != 0 {
+        let start = now_ns();
+        let mut iter = ListIterator::<BenchItem>::new(head_ptr);
+        let mut i = 1;
+        while let Some(item) = iter.next() {
+            let replacement = pool.alloc(BenchItem::new(i))?;
+            // SAFETY: the item is unlinked by the replace, then given back to its pool.
+            unsafe {
+                head.replace(item.get_list_head(), (*replacement).get_list_head());
+                pool.free(item as *mut BenchItem);
+            }
+            i += 1;
+        }
+        phase_ns[PHASE_REPLACE] = now_ns() - start;
+    }
+
+    let start = now_ns();
+    // SAFETY: every node of the list comes from the pool, which backs only this list.
+    unsafe { pool.clear(&mut head) };
+    phase_ns[PHASE_DELETE] = now_ns() - start;
+
+    Ok(())
+}
+
+/// `core::fmt::Write` over a growable buffer, used to build the report.
+struct Report(Vec<u8>);
+
+impl Write for Report {
+    fn write_str(&mut self, s: &str) -> core::fmt::Result {
+        self.0.extend_from_slice(s.as_bytes(), GFP_KERNEL).map_err(|_| core::fmt::Error)
+    }
+}
+
+/// Integer square root, for the standard deviation.
+fn isqrt(n: u64) -> u64 {
+    if n < 2 {
+        return n;
+    }
+    let mut x = n;
+    let mut y = (x + 1) / 2;
+    while y < x {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    x
+}
+
+/// Nearest-rank percentile of sorted samples.
+fn percentile(sorted: &[u64], p: usize) -> u64 {
+    let rank = (p * sorted.len() + 99) / 100;
+    sorted[rank.max(1) - 1]
+}
+
+/// Appends the statistics of one phase, the samples are in ps per element.
+fn report_phase(report: &mut Report, name: &str, phase: &str, samples: &mut [u64]) -> core::fmt::Result {
+    if samples.is_empty() {
+        return Ok(());
+    }
+    samples.sort_unstable();
+
+    let n = samples.len() as u64;
+    let mean = samples.iter().sum::<u64>() / n;
+    let variance = samples
+        .iter()
+        .map(|&s| {
+            let d = s.abs_diff(mean);
+            d * d
+        })
+        .sum::<u64>()
+        / n;
+
+    write!(report, "{}\t{}\t{}", name, phase, n)?;
+    for value in [
+        samples[0],
+        percentile(samples, 50),
+        percentile(samples, 90),
+        percentile(samples, 99),
+        samples[samples.len() - 1],
+        mean,
+        isqrt(variance),
+    ] {
+        // ps to ns with three decimals
+        write!(report, "\t{}.{:03}", value / 1000, value % 1000)?;
+    }
+    writeln!(report)
+}
+
+/// Runs both implementations with the current parameters and publishes the report.
+/// Called by c/list_bench.c, which serializes the runs.
+#[no_mangle]
+pub extern "C" fn rust_list_bench_run() -> isize {
+    let mut params = BenchParams::default();
+    // SAFETY: FFI call, it fills the structure.
+    unsafe { list_bench_get_params(&mut params) };
+
+    if params.size == 0 || params.iterations == 0 {
+        return EINVAL.to_errno() as isize;
+    }
+    let replace = params.phases & (1 << PHASE_REPLACE) != 0;
+    let native_phases = params.phases & NATIVE_PHASES;
+
+    // samples[implementation][phase]: ps per element of each measured run
+    let mut samples: [[Vec<u64>; PHASES]; IMPLS] = Default::default();
+    for implementation in samples.iter_mut() {
+        for phase in implementation.iter_mut() {
+            if phase.reserve(params.iterations as usize, GFP_KERNEL).is_err() {
+                return ENOMEM.to_errno() as isize;
+            }
+        }
+    }
+
+    // The implementations alternate at every run, so that both see the same system state
+    for run in 0..params.warmup + params.iterations {
+        for (implementation, name) in IMPL_NAMES.iter().enumerate() {
+            let mut phase_ns = [0u64; PHASES];
+            let ret = match implementation {
+                0 => rust_run(&params, &mut phase_ns),
+                // SAFETY: FFI call, phase_ns has PHASES elements.
+                1 => match unsafe { list_bench_native_run(params.size, replace, phase_ns.as_mut_ptr()) } {
+                    0 => Ok(()),
+                    errno => Err(Error::from_errno(errno)),
+                },
+                _ => rust_pool_run(&params, &mut phase_ns),
+            };
+            if let Err(e) = ret {
+                pr_err!("The {} run failed: {:?}\n", name, e);
+                return e.to_errno() as isize;
+            }
+
+            if run < params.warmup {
+                continue;
+            }
+            let measured = if implementation == 1 { native_phases } else { params.phases };
+            for phase in 0..PHASES {
+                if measured & (1 << phase) != 0 {
+                    // Capacity reserved above, the push can't fail
+                    let _ = samples[implementation][phase].push(phase_ns[phase] * 1000 / params.size as u64, GFP_KERNEL);
+                }
+            }
+        }
+    }
+
+    let mut report = Report(Vec::new());
+    let written = (|| -> core::fmt::Result {
+        writeln!(
+            report,
+            "# size {} iterations {} warmup {} prefetch {} segments {}",
+            params.size, params.iterations, params.warmup, params.prefetch, params.segments
+        )?;
+        writeln!(report, "# impl\tphase\truns\tmin\tp50\tp90\tp99\tmax\tmean\tstddev (ns/op)")?;
+        for phase in PHASE_ORDER {
+            for (implementation, name) in IMPL_NAMES.iter().enumerate() {
+                report_phase(&mut report, name, PHASE_NAMES[phase], &mut samples[implementation][phase])?;
+            }
+        }
+        Ok(())
+    })();
+    if written.is_err() {
+        return ENOMEM.to_errno() as isize;
+    }
+
+    // SAFETY: FFI call, the report is copied.
+    unsafe { list_bench_publish(report.0.as_ptr(), report.0.len()) };
+    pr_info!("Benchmark completed, results in /sys/kernel/debug/list_bench/results\n");
+    0
+}
@@ -37,6 +37,7 @@
 #include <linux/workqueue.h>
 #include <linux/mentor.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
 
 
 __noreturn void rust_helper_BUG(void)
@@ -266,6 +267,43 @@ void rust_helper_list_splice_init(struct list_head *list, struct list_head *head
 }
 EXPORT_SYMBOL_GPL(rust_helper_list_splice_init);
 
+void rust_helper_list_splice_tail(struct list_head *list, struct list_head *head) {
+    list_splice_tail(list, head);
+}
+EXPORT_SYMBOL_GPL(rust_helper_list_splice_tail);
+
+void rust_helper_list_splice_tail_init(struct list_head *list, struct list_head *head) {
+    list_splice_tail_init(list, head);
+}
+EXPORT_SYMBOL_GPL(rust_helper_list_splice_tail_init);
+
+void rust_helper_list_cut_position(struct list_head *list, struct list_head *head, struct list_head *entry) {
+    list_cut_position(list, head, entry);
+}
+EXPORT_SYMBOL_GPL(rust_helper_list_cut_position);
+
+// Helpers for hlist (llist is implemented with Rust atomics and needs none):
+
+void rust_helper_rcu_read_lock(void) {
+    rcu_read_lock();
+}
+EXPORT_SYMBOL_GPL(rust_helper_rcu_read_lock);
+
+void rust_helper_rcu_read_unlock(void) {
+    rcu_read_unlock();
+}
+EXPORT_SYMBOL_GPL(rust_helper_rcu_read_unlock);
+
+void rust_helper_hlist_add_head_rcu(struct hlist_node *n, struct hlist_head *h) {
+    hlist_add_head_rcu(n, h);
+}
+EXPORT_SYMBOL_GPL(rust_helper_hlist_add_head_rcu);
+
+void rust_helper_hlist_del_init_rcu(struct hlist_node *n) {
+    hlist_del_init_rcu(n);
+}
+EXPORT_SYMBOL_GPL(rust_helper_hlist_del_init_rcu);
+
 
 /*
  * `bindgen` binds the C `size_t` type as the Rust `usize` type, so we can
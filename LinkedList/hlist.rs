@@ -0,0 +1,234 @@
+// hlist.rs
+
+//! RCU-safe hash lists.
+//!
+//! Rust counterpart of `struct hlist_head`/`struct hlist_node`, the lists with a single
+//! pointer head used for the buckets of hash tables. The readers walk a bucket inside
+//! an RCU read-side critical section without any lock, the writers serialize among
+//! themselves (e.g. with a mutex) and free a removed node only after a grace period.
+//!
+//! C header: [`include/linux/rculist.h`](../../../../include/linux/rculist.h)
+//!
+//! All the examples are based on a simple struct defined as follows:
+//! ```rust
+//! struct MyRecord {
+//!    node: HlistNode,
+//!    key: u32,
+//!}
+//! ```
+
+use core::cell::UnsafeCell;
+use core::marker::PhantomData;
+use kernel::bindings;
+use crate::alloc::AllocError;
+use crate::prelude::*;
+
+/// Node of a hash list, it corresponds to `struct hlist_node`.
+#[repr(C)]
+pub struct HlistNode {
+    /// Pointer to the next node, null for the last one.
+    pub next: *mut HlistNode,
+    /// Pointer to the `next` field (or to the head) pointing to this node.
+    pub pprev: *mut *mut HlistNode,
+}
+
+impl HlistNode {
+    /// Creates a node that is not in any list.
+    ///
+    /// This corresponds to the `INIT_HLIST_NODE` macro in the Linux kernel.
+    pub const fn new() -> Self {
+        HlistNode {
+            next: core::ptr::null_mut(),
+            pprev: core::ptr::null_mut(),
+        }
+    }
+}
+
+/// Trait to associate a struct with its `HlistNode` member, like `ListEntry` for `ListHead`.
+pub trait HlistEntry {
+    /// Converts a `HlistNode` pointer to a pointer of the parent struct.
+    ///
+    /// # Safety
+    ///
+    /// The `ptr` must be a valid pointer to a `HlistNode` that is embedded within a `Self` instance.
+    unsafe fn parent_from_hlist_node(ptr: *mut HlistNode) -> *mut Self;
+
+    /// Given a mut reference to `Self`, returns a pointer to its `HlistNode` field.
+    fn get_hlist_node(&mut self) -> *mut HlistNode;
+}
+
+/// RCU read-side critical section, it ends when the guard is dropped.
+///
+/// The code running while the guard is alive must not sleep.
+pub struct RcuGuard {
+    // The critical section is bound to the current CPU/task, the guard can't be sent.
+    _not_send: PhantomData<*mut ()>,
+}
+
+impl RcuGuard {
+    /// Enters a read-side critical section, it corresponds to `rcu_read_lock`.
+    pub fn new() -> Self {
+        // SAFETY: FFI call, the matching unlock is done by `drop`.
+        unsafe { bindings::rcu_read_lock() };
+        RcuGuard { _not_send: PhantomData }
+    }
+}
+
+impl Drop for RcuGuard {
+    fn drop(&mut self) {
+        // SAFETY: FFI call, the lock has been taken by `new`.
+        unsafe { bindings::rcu_read_unlock() };
+    }
+}
+
+/// Head of a hash list, it corresponds to `struct hlist_head`.
+///
+/// The head can be shared between readers and writers: only the writers (the unsafe
+/// methods) modify it, under a lock held by the caller.
+#[repr(C)]
+pub struct HlistHead {
+    first: UnsafeCell<*mut HlistNode>,
+}
+
+// SAFETY: the readers only load the pointers, the writers are serialized by the caller.
+unsafe impl Sync for HlistHead {}
+unsafe impl Send for HlistHead {}
+
+impl HlistHead {
+    /// Creates an empty list.
+    ///
+    /// This corresponds to the `HLIST_HEAD_INIT` macro in the Linux kernel.
+    pub const fn new() -> Self {
+        HlistHead {
+            first: UnsafeCell::new(core::ptr::null_mut()),
+        }
+    }
+
+    fn as_ptr(&self) -> *mut bindings::hlist_head {
+        self as *const HlistHead as *mut bindings::hlist_head
+    }
+
+    /// Adds a node at the head of the list, it is visible to the new readers right away.
+    ///
+    /// This corresponds to the `hlist_add_head_rcu` function in the Linux kernel.
+    ///
+    /// # Safety
+    ///
+    /// The caller must hold the lock serializing the writers of the list. The `node`
+    /// must be valid, not in any list, and stay valid while it is in the list.
+    pub unsafe fn add_head_rcu(&self, node: *mut HlistNode) {
+        unsafe { bindings::hlist_add_head_rcu(node as *mut bindings::hlist_node, self.as_ptr()) };
+    }
+
+    /// Removes a node from its list, the current readers may still see it.
+    ///
+    /// This corresponds to the `hlist_del_init_rcu` function in the Linux kernel:
+    /// the node can be added again to a list, but it can be freed only after a grace
+    /// period (`synchronize_rcu` or `call_rcu`).
+    ///
+    /// # Safety
+    ///
+    /// The caller must hold the lock serializing the writers of the list of `node`.
+    pub unsafe fn del_init_rcu(node: *mut HlistNode) {
+        unsafe { bindings::hlist_del_init_rcu(node as *mut bindings::hlist_node) };
+    }
+
+    /// Checks if the list is empty.
+    ///
+    /// This corresponds to the `hlist_empty` function in the Linux kernel.
+    pub fn is_empty(&self) -> bool {
+        // SAFETY: a racy read of a pointer, the writers store it atomically.
+        unsafe { core::ptr::read_volatile(self.first.get()).is_null() }
+    }
+
+    /// Iterates over the entries of the list, without any lock.
+    ///
+    /// This corresponds to the `hlist_for_each_entry_rcu` macro in the Linux kernel.
+    /// The entries are valid as long as the guard is alive; the writers may add or
+    /// remove entries meanwhile, the iteration returns a consistent subset of them.
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// let guard = RcuGuard::new();
+    /// let found = buckets.bucket(key).iter_rcu::<MyRecord>(&guard).find(|record| record.key == key);
+    /// ```
+    pub fn iter_rcu<'a, T: HlistEntry>(&'a self, _guard: &'a RcuGuard) -> HlistRcuIterator<'a, T> {
+        HlistRcuIterator {
+            // SAFETY: as `rcu_dereference`, the node is published by a release store.
+            current: unsafe { core::ptr::read_volatile(self.first.get()) },
+            _marker: PhantomData,
+        }
+    }
+}
+
+/// Iterator over the entries of a `HlistHead`, in an RCU read-side critical section.
+pub struct HlistRcuIterator<'a, T: HlistEntry> {
+    current: *mut HlistNode,
+    _marker: PhantomData<&'a T>,
+}
+
+impl<'a, T: HlistEntry> Iterator for HlistRcuIterator<'a, T> {
+    type Item = &'a T;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.current.is_null() {
+            return None;
+        }
+
+        unsafe {
+            let ptr = T::parent_from_hlist_node(self.current);
+            // As `rcu_dereference`: a dependent load of the published pointer
+            self.current = core::ptr::read_volatile(&(*self.current).next);
+            Some(&*ptr)
+        }
+    }
+}
+
+/// Fixed array of `HlistHead` buckets, the base of an RCU hash table.
+///
+/// # Example
+///
+/// ```rust
+/// let buckets = HlistBuckets::new(8)?; // 256 buckets
+/// // Writer, under the table lock
+/// unsafe { buckets.bucket(record.key as u64).add_head_rcu(record.get_hlist_node()) };
+/// ```
+pub struct HlistBuckets {
+    heads: Vec<HlistHead>,
+    bits: u32,
+}
+
+impl HlistBuckets {
+    /// Allocates `1 << bits` empty buckets.
+    pub fn new(bits: u32) -> Result<Self, AllocError> {
+        let len = 1usize << bits;
+        let mut heads = Vec::with_capacity(len, GFP_KERNEL)?;
+        for _ in 0..len {
+            heads.push(HlistHead::new(), GFP_KERNEL)?;
+        }
+
+        Ok(HlistBuckets { heads, bits })
+    }
+
+    /// Returns the bucket of the given key.
+    pub fn bucket(&self, key: u64) -> &HlistHead {
+        // Fibonacci hashing, as `hash_64`: the high bits are well mixed
+        let index = if self.bits == 0 {
+            0
+        } else {
+            (key.wrapping_mul(0x61C8_8646_80B5_83EB) >> (64 - self.bits)) as usize
+        };
+        &self.heads[index]
+    }
+
+    /// Number of buckets.
+    pub fn len(&self) -> usize {
+        self.heads.len()
+    }
+
+    /// Iterates over all the buckets, e.g. to empty the table before dropping it.
+    pub fn iter(&self) -> impl Iterator<Item = &HlistHead> {
+        self.heads.iter()
+    }
+}
@@ -0,0 +1,226 @@
+// llist.rs
+
+//! Lock-less singly linked lists.
+//!
+//! Rust counterpart of `struct llist_head`/`struct llist_node`, with the same layout so
+//! that a list can be shared with C code. Any number of producers can push nodes
+//! concurrently without a lock; the consumer takes the whole list at once with
+//! `del_all`. The operations are implemented with Rust atomics, like the C inline
+//! functions, so nothing is called through FFI on the producer path.
+//!
+//! C header: [`include/linux/llist.h`](../../../../include/linux/llist.h)
+//!
+//! All the examples are based on a simple struct defined as follows:
+//! ```rust
+//! struct MyEvent {
+//!    node: LlistNode,
+//!    data: u32,
+//!}
+//! ```
+
+use core::marker::PhantomData;
+use core::sync::atomic::{AtomicPtr, Ordering};
+
+/// Node of a lock-less list, it corresponds to `struct llist_node`.
+#[repr(C)]
+pub struct LlistNode {
+    /// Pointer to the next node, null for the last one.
+    pub next: *mut LlistNode,
+}
+
+impl LlistNode {
+    /// Creates a node that is not in any list.
+    pub const fn new() -> Self {
+        LlistNode {
+            next: core::ptr::null_mut(),
+        }
+    }
+}
+
+/// Trait to associate a struct with its `LlistNode` member, like `ListEntry` for `ListHead`.
+pub trait LlistEntry {
+    /// Converts a `LlistNode` pointer to a pointer of the parent struct.
+    ///
+    /// # Safety
+    ///
+    /// The `ptr` must be a valid pointer to a `LlistNode` that is embedded within a `Self` instance.
+    unsafe fn parent_from_llist_node(ptr: *mut LlistNode) -> *mut Self;
+
+    /// Given a mut reference to `Self`, returns a pointer to its `LlistNode` field.
+    fn get_llist_node(&mut self) -> *mut LlistNode;
+}
+
+/// Head of a lock-less list, it corresponds to `struct llist_head`.
+///
+/// # Example
+///
+/// ```rust
+/// static EVENTS: LlistHead = LlistHead::new();
+///
+/// // Producers, on any CPU and in any context (also interrupts)
+/// let event = Box::leak(Box::new(MyEvent::new(1), GFP_KERNEL)?);
+/// EVENTS.add(event.get_llist_node());
+///
+/// // Consumer
+/// for event in EVENTS.del_all().reverse().iter::<MyEvent>() {
+///     pr_info!("Event {}\n", event.data);
+/// }
+/// ```
+#[repr(C)]
+pub struct LlistHead {
+    first: AtomicPtr<LlistNode>,
+}
+
+impl LlistHead {
+    /// Creates an empty list.
+    pub const fn new() -> Self {
+        LlistHead {
+            first: AtomicPtr::new(core::ptr::null_mut()),
+        }
+    }
+
+    /// Adds a node at the head of the list, it can be called concurrently by many producers.
+    ///
+    /// This corresponds to the `llist_add` function in the Linux kernel.
+    /// Returns `true` if the list was empty, e.g. to know when the consumer must be woken up.
+    ///
+    /// # Safety
+    ///
+    /// The `node` must be valid and not in any list, and it must stay valid until it
+    /// is taken back by the consumer.
+    pub unsafe fn add(&self, node: *mut LlistNode) -> bool {
+        unsafe { self.add_batch(node, node) }
+    }
+
+    /// Adds a chain of nodes, from `first` to `last` already linked, at the head of the list.
+    ///
+    /// This corresponds to the `llist_add_batch` function in the Linux kernel.
+    /// Returns `true` if the list was empty.
+    ///
+    /// # Safety
+    ///
+    /// As for `add`, for every node of the chain.
+    pub unsafe fn add_batch(&self, first: *mut LlistNode, last: *mut LlistNode) -> bool {
+        let mut head = self.first.load(Ordering::Relaxed);
+        loop {
+            // SAFETY: the caller owns the chain until it is published by the exchange.
+            unsafe { (*last).next = head };
+            // Release: the content of the nodes is visible to the consumer that takes them
+            match self.first.compare_exchange_weak(head, first, Ordering::Release, Ordering::Relaxed) {
+                Ok(_) => return head.is_null(),
+                Err(current) => head = current,
+            }
+        }
+    }
+
+    /// Takes all the nodes of the list, leaving it empty.
+    ///
+    /// This corresponds to the `llist_del_all` function in the Linux kernel.
+    /// The nodes are returned newest first, use `LlistBatch::reverse` for the insertion order.
+    pub fn del_all(&self) -> LlistBatch {
+        LlistBatch {
+            // Acquire: pairs with the release of the producers
+            first: self.first.swap(core::ptr::null_mut(), Ordering::Acquire),
+        }
+    }
+
+    /// Takes the newest node of the list, or null if it is empty.
+    ///
+    /// This corresponds to the `llist_del_first` function in the Linux kernel.
+    ///
+    /// # Safety
+    ///
+    /// Only `add` and `add_batch` may run concurrently with it. The consumers must be
+    /// serialized by the caller (e.g. with a lock): a `del_first` racing with another
+    /// `del_first` or with `del_all` can read the `next` of a node taken and added back
+    /// meanwhile, and the exchange would then succeed with a stale `next` (ABA).
+    pub unsafe fn del_first(&self) -> *mut LlistNode {
+        let mut first = self.first.load(Ordering::Acquire);
+        loop {
+            if first.is_null() {
+                return first;
+            }
+            // SAFETY: the consumers are serialized, the first node can't be taken meanwhile.
+            let next = unsafe { (*first).next };
+            match self.first.compare_exchange_weak(first, next, Ordering::Acquire, Ordering::Acquire) {
+                Ok(_) => return first,
+                Err(current) => first = current,
+            }
+        }
+    }
+
+    /// Checks if the list is empty, the answer may be stale as soon as it is returned.
+    ///
+    /// This corresponds to the `llist_empty` function in the Linux kernel.
+    pub fn is_empty(&self) -> bool {
+        self.first.load(Ordering::Relaxed).is_null()
+    }
+}
+
+/// Chain of nodes taken from a `LlistHead`, owned by the consumer.
+pub struct LlistBatch {
+    first: *mut LlistNode,
+}
+
+impl LlistBatch {
+    /// Reverses the chain, so that the nodes are in insertion order.
+    ///
+    /// This corresponds to the `llist_reverse_order` function in the Linux kernel.
+    pub fn reverse(self) -> Self {
+        let mut reversed: *mut LlistNode = core::ptr::null_mut();
+        let mut current = self.first;
+        while !current.is_null() {
+            // SAFETY: the chain is owned by the batch.
+            unsafe {
+                let next = (*current).next;
+                (*current).next = reversed;
+                reversed = current;
+                current = next;
+            }
+        }
+        LlistBatch { first: reversed }
+    }
+
+    /// Returns `true` if the chain has no node.
+    pub fn is_empty(&self) -> bool {
+        self.first.is_null()
+    }
+
+    /// Returns the first node of the chain, null if it is empty.
+    pub fn first(&self) -> *mut LlistNode {
+        self.first
+    }
+
+    /// Iterates over the entries of the chain.
+    ///
+    /// The next node is read before an entry is returned, so the entry can be freed
+    /// or added to another list (like `llist_for_each_entry_safe`).
+    pub fn iter<'a, T: LlistEntry>(self) -> LlistIterator<'a, T> {
+        LlistIterator {
+            current: self.first,
+            _marker: PhantomData,
+        }
+    }
+}
+
+/// Iterator over the entries of a `LlistBatch`.
+pub struct LlistIterator<'a, T: LlistEntry> {
+    current: *mut LlistNode,
+    _marker: PhantomData<&'a mut T>,
+}
+
+impl<'a, T: LlistEntry> Iterator for LlistIterator<'a, T> {
+    type Item = &'a mut T;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.current.is_null() {
+            return None;
+        }
+
+        unsafe {
+            let ptr = T::parent_from_llist_node(self.current);
+            self.current = (*self.current).next;
+            Some(&mut *ptr)
+        }
+    }
+}
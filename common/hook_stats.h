@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0
+// hook_stats.h
+// Per-CPU call counter and latency histogram of a hook, shared by the CharDevice
+// (ioctl), Kprobes (handler_pre) and LSM (file_open, ...) modules. Each CPU updates
+// its own copy without atomics, the copies are summed only when they are printed.
+
+#ifndef HOOK_STATS_H
+#define HOOK_STATS_H
+
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/timekeeping.h>
+
+// Latency histogram buckets: bucket i counts the calls taking [2^(i-1), 2^i) ns
+#define HOOK_HIST_BUCKETS 32
+
+struct hook_stats {
+    u64 hits;
+    u64 total_ns;
+    u64 hist[HOOK_HIST_BUCKETS];
+};
+
+// Records a call started at start_ns (ktime_get_ns)
+static __always_inline void hook_stats_record(struct hook_stats __percpu *stats, u64 start_ns)
+{
+    u64 ns = ktime_get_ns() - start_ns;
+
+    this_cpu_inc(stats->hits);
+    this_cpu_add(stats->total_ns, ns);
+    this_cpu_inc(stats->hist[min_t(int, fls64(ns), HOOK_HIST_BUCKETS - 1)]);
+}
+
+static inline void hook_stats_print(struct seq_file *m, const char *name, struct hook_stats __percpu *stats)
+{
+    struct hook_stats sum = {};
+    int cpu, i;
+
+    for_each_possible_cpu(cpu) {
+        struct hook_stats *cpu_stats = per_cpu_ptr(stats, cpu);
+
+        sum.hits += cpu_stats->hits;
+        sum.total_ns += cpu_stats->total_ns;
+        for (i = 0; i < HOOK_HIST_BUCKETS; i++)
+            sum.hist[i] += cpu_stats->hist[i];
+    }
+
+    seq_printf(m, "%s: hits %llu avg_ns %llu\n", name, sum.hits,
+               sum.hits ? div64_u64(sum.total_ns, sum.hits) : 0);
+    for (i = 0; i < HOOK_HIST_BUCKETS; i++) {
+        if (!sum.hist[i])
+            continue;
+        if (i == HOOK_HIST_BUCKETS - 1)
+            seq_printf(m, "  >= %llu ns: %llu\n", 1ULL << (i - 1), sum.hist[i]);
+        else
+            seq_printf(m, "  %llu-%llu ns: %llu\n", i ? 1ULL << (i - 1) : 0, (1ULL << i) - 1, sum.hist[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: GPL-2.0
+// uid_hash.rs
+//! Hash of the user IDs shared by the modules that index them in open addressing
+//! tables (the UID index of CharDevice, the blacklist of Kprobes). Include it with
+//! `#[path = ".../common/uid_hash.rs"] mod uid_hash;`.
+
+/// Home slot of `uid` in a table of `capacity` slots, a power of two.
+///
+/// Fibonacci hashing, as `hash_32` of `<linux/hash.h>`: the top bits of the product
+/// depend on every bit of the UID, the low ones only on `uid` modulo the capacity.
+#[inline]
+pub(crate) fn hash_uid(uid: u32, capacity: usize) -> usize {
+    let bits = capacity.trailing_zeros();
+    if bits == 0 {
+        return 0;
+    }
+    (uid.wrapping_mul(0x61C8_8647) >> (32 - bits)) as usize
+}
@@ -6,11 +6,17 @@
 //! functions related to jiffies. Jiffies are the units of time used by the kernel
 //! to represent the passage of time, and these functions help in converting 
 //! jiffies to more common time units such as milliseconds and microseconds.
+//!
+//! For finer measures it also wraps the nanosecond clocks and the CPU cycle counter,
+//! with a [`ScopedTimer`] recording the duration of a scope into a [`Histogram`].
 
-//! C headers: [`include/linux/jiffies.h`](../../../../include/linux/jiffies.h)
+//! C headers: [`include/linux/jiffies.h`](../../../../include/linux/jiffies.h),
+//! [`include/linux/timekeeping.h`](../../../../include/linux/timekeeping.h),
+//! [`include/linux/sched/clock.h`](../../../../include/linux/sched/clock.h)
 
 use kernel::bindings;
 use core::ffi::c_ulong;
+use core::sync::atomic::{AtomicU64, Ordering};
 
 
 /// Converts a given number of jiffies to milliseconds.
@@ -64,3 +70,277 @@ pub fn jiffies_to_usecs(j: u64) -> u64 {
     // Call the unsafe kernel function within a safe Rust function.
     unsafe { bindings::jiffies_to_usecs(j as c_ulong) as u64 }
 }
+
+/// Returns the monotonic time in nanoseconds, the same clock as `ktime_get_ns()` in C.
+///
+/// `ktime_get_ns` is an inline function in C, the call goes straight to the exported
+/// `ktime_get` without any helper.
+///
+/// # Example
+///
+/// ```rust
+/// let start = jiffies::ktime_get_ns();
+/// ```
+#[inline]
+pub fn ktime_get_ns() -> u64 {
+    // SAFETY: FFI call without arguments, callable from any context but NMI.
+    unsafe { bindings::ktime_get() as u64 }
+}
+
+/// Returns the monotonic time in nanoseconds, read without the timekeeping seqcount.
+///
+/// Safe to use in NMI and tracing paths, but two CPUs can see it step backwards by a few
+/// nanoseconds while the clock is updated. See `ktime_get_mono_fast_ns()` in C.
+///
+/// # Example
+///
+/// ```rust
+/// let now = jiffies::ktime_get_mono_fast_ns();
+/// ```
+#[inline]
+pub fn ktime_get_mono_fast_ns() -> u64 {
+    // SAFETY: FFI call without arguments, callable from any context.
+    unsafe { bindings::ktime_get_mono_fast_ns() }
+}
+
+/// Returns the scheduler clock of the current CPU in nanoseconds.
+///
+/// The cheapest clock in nanoseconds, but only comparable with readings from the same CPU:
+/// a measure is meaningful only if the task does not migrate in between.
+///
+/// # Example
+///
+/// ```rust
+/// let now = jiffies::local_clock();
+/// ```
+#[cfg(CONFIG_HAVE_UNSTABLE_SCHED_CLOCK)]
+#[inline]
+pub fn local_clock() -> u64 {
+    // SAFETY: FFI call without arguments, callable from any context.
+    unsafe { bindings::local_clock() }
+}
+
+/// Returns the scheduler clock of the current CPU in nanoseconds.
+///
+/// Without an unstable sched_clock, `local_clock` is `sched_clock` inlined.
+#[cfg(not(CONFIG_HAVE_UNSTABLE_SCHED_CLOCK))]
+#[inline]
+pub fn local_clock() -> u64 {
+    // SAFETY: FFI call without arguments, callable from any context.
+    unsafe { bindings::sched_clock() as u64 }
+}
+
+/// Returns the cycle counter of the current CPU, like `get_cycles()` in C.
+///
+/// The counter is read with a single instruction: the TSC on x86_64, the virtual counter
+/// on aarch64. Other architectures return 0, as the generic `get_cycles()` does. The unit
+/// depends on the CPU, use it to compare runs on the same machine.
+///
+/// # Example
+///
+/// ```rust
+/// let start = jiffies::get_cycles();
+/// ```
+#[cfg(target_arch = "x86_64")]
+#[inline(always)]
+pub fn get_cycles() -> u64 {
+    let lo: u32;
+    let hi: u32;
+    // SAFETY: `rdtsc` only reads the time stamp counter.
+    unsafe { core::arch::asm!("rdtsc", out("eax") lo, out("edx") hi, options(nomem, nostack)) };
+    ((hi as u64) << 32) | lo as u64
+}
+
+/// Returns the cycle counter of the current CPU, like `get_cycles()` in C.
+#[cfg(target_arch = "aarch64")]
+#[inline(always)]
+pub fn get_cycles() -> u64 {
+    let cycles: u64;
+    // SAFETY: `cntvct_el0` is readable at EL1, the `isb` keeps the read in order.
+    unsafe { core::arch::asm!("isb", "mrs {}, cntvct_el0", out(reg) cycles, options(nomem, nostack)) };
+    cycles
+}
+
+/// Returns the cycle counter of the current CPU, like `get_cycles()` in C.
+#[cfg(not(any(target_arch = "x86_64", target_arch = "aarch64")))]
+#[inline(always)]
+pub fn get_cycles() -> u64 {
+    0
+}
+
+/// Number of buckets of a [`Histogram`], the last one collects all the longer samples.
+pub const HISTOGRAM_BUCKETS: usize = 32;
+
+/// A log2 histogram of durations in nanoseconds.
+///
+/// Bucket `i` counts the samples in `[2^(i-1), 2^i)` ns, bucket 0 the samples of 0 ns.
+/// The counters are atomic, a histogram can be shared by all the CPUs recording into it.
+///
+/// # Example
+///
+/// ```rust
+/// static HOOK_LATENCY: jiffies::Histogram = jiffies::Histogram::new();
+///
+/// fn hook() {
+///     let _timer = jiffies::ScopedTimer::new(&HOOK_LATENCY);
+///     // ... timed code ...
+/// }
+/// ```
+pub struct Histogram {
+    hits: AtomicU64,
+    total_ns: AtomicU64,
+    buckets: [AtomicU64; HISTOGRAM_BUCKETS],
+}
+
+impl Histogram {
+    /// Creates an empty histogram, usable in a `static`.
+    pub const fn new() -> Self {
+        #[allow(clippy::declare_interior_mutable_const)]
+        const ZERO: AtomicU64 = AtomicU64::new(0);
+        Histogram {
+            hits: ZERO,
+            total_ns: ZERO,
+            buckets: [ZERO; HISTOGRAM_BUCKETS],
+        }
+    }
+
+    /// Returns the bucket of a sample of `ns` nanoseconds.
+    #[inline]
+    pub fn bucket(ns: u64) -> usize {
+        ((u64::BITS - ns.leading_zeros()) as usize).min(HISTOGRAM_BUCKETS - 1)
+    }
+
+    /// Records a sample of `ns` nanoseconds.
+    #[inline]
+    pub fn record(&self, ns: u64) {
+        self.hits.fetch_add(1, Ordering::Relaxed);
+        self.total_ns.fetch_add(ns, Ordering::Relaxed);
+        self.buckets[Self::bucket(ns)].fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Returns the number of samples.
+    pub fn hits(&self) -> u64 {
+        self.hits.load(Ordering::Relaxed)
+    }
+
+    /// Returns the sum of all the samples, in nanoseconds.
+    pub fn total_ns(&self) -> u64 {
+        self.total_ns.load(Ordering::Relaxed)
+    }
+
+    /// Returns the average of the samples in nanoseconds, 0 without samples.
+    pub fn avg_ns(&self) -> u64 {
+        match self.hits() {
+            0 => 0,
+            hits => self.total_ns() / hits,
+        }
+    }
+
+    /// Returns the number of samples in bucket `i`.
+    pub fn count(&self, i: usize) -> u64 {
+        self.buckets[i].load(Ordering::Relaxed)
+    }
+
+    /// Returns the range of bucket `i` in nanoseconds, the end is excluded.
+    pub fn range(i: usize) -> (u64, u64) {
+        match i {
+            0 => (0, 1),
+            i if i == HISTOGRAM_BUCKETS - 1 => (1 << (i - 1), u64::MAX),
+            i => (1 << (i - 1), 1 << i),
+        }
+    }
+
+    /// Clears all the samples.
+    pub fn reset(&self) {
+        self.hits.store(0, Ordering::Relaxed);
+        self.total_ns.store(0, Ordering::Relaxed);
+        for bucket in &self.buckets {
+            bucket.store(0, Ordering::Relaxed);
+        }
+    }
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Clock read by a [`ScopedTimer`], in nanoseconds.
+///
+/// Every `Fn() -> u64` is a clock, e.g. [`local_clock`]; [`KtimeClock`] is the default one.
+pub trait Clock {
+    /// Returns the current time in nanoseconds.
+    fn now(&self) -> u64;
+}
+
+impl<F: Fn() -> u64> Clock for F {
+    #[inline(always)]
+    fn now(&self) -> u64 {
+        self()
+    }
+}
+
+/// [`ktime_get_ns`] as a [`Clock`], the one used by [`ScopedTimer::new`].
+#[derive(Clone, Copy, Default)]
+pub struct KtimeClock;
+
+impl Clock for KtimeClock {
+    #[inline(always)]
+    fn now(&self) -> u64 {
+        ktime_get_ns()
+    }
+}
+
+/// Measures the time until it is dropped and records it into a [`Histogram`].
+///
+/// By default the time is read with [`ktime_get_ns`], [`ScopedTimer::with_clock`] takes
+/// any other clock in nanoseconds, e.g. [`local_clock`] when the task cannot migrate.
+/// The clock is a type parameter: a function or a closure is called directly, and it
+/// takes no room in the timer.
+///
+/// # Example
+///
+/// ```rust
+/// let hist = jiffies::Histogram::new();
+/// {
+///     let _timer = jiffies::ScopedTimer::new(&hist);
+///     // ... timed code ...
+/// }
+/// assert_eq!(hist.hits(), 1);
+/// ```
+pub struct ScopedTimer<'a, C: Clock = KtimeClock> {
+    hist: &'a Histogram,
+    clock: C,
+    start: u64,
+}
+
+impl<'a> ScopedTimer<'a> {
+    /// Starts a timer recording into `hist` with [`ktime_get_ns`].
+    #[inline]
+    pub fn new(hist: &'a Histogram) -> Self {
+        Self::with_clock(hist, KtimeClock)
+    }
+}
+
+impl<'a, C: Clock> ScopedTimer<'a, C> {
+    /// Starts a timer recording into `hist` with `clock`.
+    #[inline]
+    pub fn with_clock(hist: &'a Histogram, clock: C) -> Self {
+        let start = clock.now();
+        ScopedTimer { hist, clock, start }
+    }
+
+    /// Returns the nanoseconds elapsed so far.
+    #[inline]
+    pub fn elapsed_ns(&self) -> u64 {
+        self.clock.now().wrapping_sub(self.start)
+    }
+}
+
+impl<C: Clock> Drop for ScopedTimer<'_, C> {
+    #[inline]
+    fn drop(&mut self) {
+        self.hist.record(self.elapsed_ns());
+    }
+}
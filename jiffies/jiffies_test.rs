@@ -22,6 +22,27 @@ impl kernel::Module for JiffiesTest {
         let jiffies = 1001;
         let usecs = jiffies::jiffies_to_usecs(jiffies);
         pr_info!("Microseconds: {}\n", usecs);
+
+        pr_info!("ktime_get_ns: {}\n", jiffies::ktime_get_ns());
+        pr_info!("ktime_get_mono_fast_ns: {}\n", jiffies::ktime_get_mono_fast_ns());
+        pr_info!("local_clock: {}\n", jiffies::local_clock());
+
+        // Cost of reading each clock, one sample per read
+        let hist = jiffies::Histogram::new();
+        let start_cycles = jiffies::get_cycles();
+        for _ in 0..1000 {
+            let _timer = jiffies::ScopedTimer::new(&hist);
+            core::hint::black_box(jiffies::ktime_get_mono_fast_ns());
+        }
+        let cycles = jiffies::get_cycles().wrapping_sub(start_cycles);
+        pr_info!("1000 timed reads: {} cycles, avg {} ns\n", cycles, hist.avg_ns());
+        for i in 0..jiffies::HISTOGRAM_BUCKETS {
+            if hist.count(i) > 0 {
+                let (low, high) = jiffies::Histogram::range(i);
+                pr_info!("  {}-{} ns: {}\n", low, high, hist.count(i));
+            }
+        }
+
         Ok(JiffiesTest)
     }
 }
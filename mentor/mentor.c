@@ -1,36 +1,81 @@
 // SPDX-License-Identifier: GPL-2.0
 
 #include <linux/mentor.h>
-#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/percpu.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
 
-static DEFINE_SPINLOCK(mentor_lock);
-static u32 mentor_data[MENTOR_TOTAL_WRITES_ADDR + 1] = { 40, 41, 42, 43, 44, 0 };
+// Every register has its own seqlock, on its own cache line: writers to different
+// addresses never touch the same lock. Readers never take it, a single register is read
+// with READ_ONCE, a snapshot of all of them retries if a write ran meanwhile.
+struct mentor_reg {
+	seqlock_t lock;
+	u32 value;
+} ____cacheline_aligned_in_smp;
+
+static struct mentor_reg mentor_regs[MENTOR_TOTAL_WRITES_ADDR] = {
+	{ .lock = __SEQLOCK_UNLOCKED(mentor_regs[0].lock), .value = 40 },
+	{ .lock = __SEQLOCK_UNLOCKED(mentor_regs[1].lock), .value = 41 },
+	{ .lock = __SEQLOCK_UNLOCKED(mentor_regs[2].lock), .value = 42 },
+	{ .lock = __SEQLOCK_UNLOCKED(mentor_regs[3].lock), .value = 43 },
+	{ .lock = __SEQLOCK_UNLOCKED(mentor_regs[4].lock), .value = 44 },
+};
+
+// The total number of writes is counted per CPU and summed when it is read
+static DEFINE_PER_CPU(u32, mentor_total_writes);
 
 static u32 mentor_simulate_undefined_behavior(void) {
 	printk(KERN_CRIT "mentor: undefined behavior!\n");
 	return 0xFFFFFFFF;
 }
 
-u32 __mentor_read(u8 addr)
+static u32 mentor_sum_total_writes(void)
 {
-	u32 result;
-	unsigned long flags;
+	u32 total = 0;
+	int cpu;
 
+	for_each_possible_cpu(cpu)
+		total += READ_ONCE(per_cpu(mentor_total_writes, cpu));
+
+	return total;
+}
+
+u32 __mentor_read(u8 addr)
+{
 	if (addr > MENTOR_TOTAL_WRITES_ADDR)
 		return mentor_simulate_undefined_behavior();
 
-	spin_lock_irqsave(&mentor_lock, flags);
-	result = mentor_data[addr];
-	spin_unlock_irqrestore(&mentor_lock, flags);
+	if (addr == MENTOR_TOTAL_WRITES_ADDR)
+		return mentor_sum_total_writes();
 
-	return result;
+	return READ_ONCE(mentor_regs[addr].value);
 }
 EXPORT_SYMBOL_GPL(__mentor_read);
 
+void mentor_read_all(u32 *values)
+{
+	unsigned int seq[MENTOR_TOTAL_WRITES_ADDR];
+	int i;
+
+retry:
+	for (i = 0; i < MENTOR_TOTAL_WRITES_ADDR; i++)
+		seq[i] = read_seqbegin(&mentor_regs[i].lock);
+
+	for (i = 0; i < MENTOR_TOTAL_WRITES_ADDR; i++)
+		values[i] = READ_ONCE(mentor_regs[i].value);
+	// Counted inside the write sections: stable as long as no sequence moves
+	values[MENTOR_TOTAL_WRITES_ADDR] = mentor_sum_total_writes();
+
+	for (i = 0; i < MENTOR_TOTAL_WRITES_ADDR; i++)
+		if (read_seqretry(&mentor_regs[i].lock, seq[i]))
+			goto retry;
+}
+EXPORT_SYMBOL_GPL(mentor_read_all);
+
 void mentor_write(u8 addr, u32 value)
 {
+	struct mentor_reg *reg;
 	unsigned long flags;
 
 	if (addr >= MENTOR_TOTAL_WRITES_ADDR) {
@@ -38,10 +83,13 @@ void mentor_write(u8 addr, u32 value)
 		return;
 	}
 
-	spin_lock_irqsave(&mentor_lock, flags);
-	mentor_data[addr] = value;
-	++mentor_data[MENTOR_TOTAL_WRITES_ADDR];
-	spin_unlock_irqrestore(&mentor_lock, flags);
+	reg = &mentor_regs[addr];
+
+	// irqsave: a reader interrupting the writer on the same CPU would spin forever
+	write_seqlock_irqsave(&reg->lock, flags);
+	WRITE_ONCE(reg->value, value);
+	this_cpu_inc(mentor_total_writes);
+	write_sequnlock_irqrestore(&reg->lock, flags);
 }
 EXPORT_SYMBOL_GPL(mentor_write);
 
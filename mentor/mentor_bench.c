@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <linux/mentor.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+#include <linux/wait.h>
+
+// Stress test of mentor_write: the same number of writes is repeated with 1, 2, 4, ...
+// threads, each one bound to its own CPU, writing either to distinct addresses (thread i
+// writes to i % MENTOR_TOTAL_WRITES_ADDR) or all to address 0. The results are printed
+// when the module is loaded.
+
+static unsigned int threads;
+module_param(threads, uint, 0444);
+MODULE_PARM_DESC(threads, "Max number of writer threads (default: online CPUs)");
+
+static unsigned int writes = 1000000;
+module_param(writes, uint, 0444);
+MODULE_PARM_DESC(writes, "Writes done by each thread");
+
+struct mentor_bench_thread {
+	struct completion done;
+	u8 addr;
+};
+
+// The writers sleep until all of them are started, then the clock starts and they are
+// released together. Nobody spins: a writer may be bound to the CPU of the thread
+// waiting for it.
+static atomic_t mentor_bench_ready;
+static DECLARE_WAIT_QUEUE_HEAD(mentor_bench_ready_wait);
+static DECLARE_COMPLETION(mentor_bench_go);
+
+static int mentor_bench_writer(void *data)
+{
+	struct mentor_bench_thread *thread = data;
+	unsigned int i;
+
+	atomic_inc(&mentor_bench_ready);
+	wake_up(&mentor_bench_ready_wait);
+	wait_for_completion(&mentor_bench_go);
+
+	for (i = 0; i < writes; i++) {
+		mentor_write(thread->addr, i);
+		// Leaves the CPU to the others on a kernel without preemption
+		if (!(i & 0xffff))
+			cond_resched();
+	}
+
+	// Never returns to the module: it can be unloaded as soon as the completion is seen
+	kthread_complete_and_exit(&thread->done, 0);
+}
+
+// Returns the time taken by nr writers, 0 if they could not be started.
+static u64 mentor_bench_run(struct mentor_bench_thread *bench, unsigned int nr, bool shared)
+{
+	struct task_struct *task;
+	unsigned int i, started = 0;
+	u64 start_ns;
+	int cpu = -1;
+
+	atomic_set(&mentor_bench_ready, 0);
+	reinit_completion(&mentor_bench_go);
+
+	for (i = 0; i < nr; i++) {
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		bench[i].addr = shared ? 0 : i % MENTOR_TOTAL_WRITES_ADDR;
+		init_completion(&bench[i].done);
+
+		task = kthread_create(mentor_bench_writer, &bench[i], "mentor_bench/%u", i);
+		if (IS_ERR(task))
+			break;
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+		started++;
+	}
+
+	wait_event(mentor_bench_ready_wait, atomic_read(&mentor_bench_ready) == started);
+
+	start_ns = ktime_get_ns();
+	complete_all(&mentor_bench_go);
+	for (i = 0; i < started; i++)
+		wait_for_completion(&bench[i].done);
+
+	if (started < nr) {
+		printk(KERN_ERR "mentor_bench: could not start %u threads\n", nr);
+		return 0;
+	}
+	return ktime_get_ns() - start_ns;
+}
+
+static void mentor_bench_print(struct mentor_bench_thread *bench, unsigned int max, bool shared)
+{
+	unsigned int nr;
+	u64 ns, base = 0, scaling;
+
+	printk(KERN_INFO "mentor_bench: %s addresses, %u writes per thread\n",
+	       shared ? "shared" : "distinct", writes);
+
+	for (nr = 1; ; nr = min(nr * 2, max)) {
+		ns = mentor_bench_run(bench, nr, shared);
+		if (!ns)
+			return;
+
+		// Throughput relative to a single thread, in hundredths
+		if (nr == 1)
+			base = ns;
+		scaling = div64_u64(base * nr * 100, ns);
+		printk(KERN_INFO "mentor_bench:   threads %u: %llu ns, %llu writes/s, scaling %llu.%02llu\n",
+		       nr, ns, div64_u64((u64)nr * writes * NSEC_PER_SEC, ns), scaling / 100, scaling % 100);
+
+		if (nr == max)
+			break;
+	}
+}
+
+static int __init mentor_bench_init(void)
+{
+	struct mentor_bench_thread *bench;
+	unsigned int max = threads ? min(threads, num_online_cpus()) : num_online_cpus();
+
+	bench = kcalloc(max, sizeof(*bench), GFP_KERNEL);
+	if (!bench)
+		return -ENOMEM;
+
+	mentor_bench_print(bench, max, false);
+	mentor_bench_print(bench, max, true);
+	printk(KERN_INFO "mentor_bench: total writes = %u\n", mentor_read(MENTOR_TOTAL_WRITES_ADDR));
+
+	kfree(bench);
+	return 0;
+}
+
+static void __exit mentor_bench_exit(void)
+{
+}
+
+module_init(mentor_bench_init);
+module_exit(mentor_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Luca Saverio Esposito");
+MODULE_DESCRIPTION("Multi-threaded stress benchmark of mentor_write");
@@ -53,6 +53,14 @@ impl kernel::Module for MentorTest {
         let total_writes = mentor::read_total_writes();
         pr_info!("Total writes = {}\n", total_writes);
 
+        // All the addresses with a single call, the values are consistent with each other.
+        pr_info!("Reading all the addresses\n");
+        let values = mentor::read_all();
+        for (addr, value) in values[..mentor::ADDRESSES - 1].iter().enumerate() {
+            pr_info!("Address {} = {}\n", addr, value);
+        }
+        pr_info!("Total writes = {}\n", values[mentor::ADDRESSES - 1]);
+
         // Whatever we try to do here, as long as it is safe code,
         // we cannot produce UB.
         let bad_addr = 0x42;